@@ -0,0 +1,227 @@
+#include "config.h"
+#if USE_ALARM
+/* threshold comparators driving the alarm output */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include "hal.h"
+#include "tick.h"
+#include "alarm.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+#if !USE_SONAR && !USE_OPTICAL
+	#error "USE_ALARM needs the sonar or the optical sensor"
+#endif
+
+/* echo time per cm, as converted by sonar_last_pong() */
+#if SLOPPY_SONAR_CONVERSION
+#define ALARM_US_PER_CM 64
+#else
+#define ALARM_US_PER_CM 58
+#endif
+
+/* echoes further apart (in ms) do not yield a rate of approach */
+#define ALARM_MAX_INTERVAL 250
+/* optical counts are added up over this many ms before comparing them */
+#define ALARM_MOTION_WINDOW 100
+
+static struct alarm_data_t *alarm_data;
+
+/* thresholds in the units of the measurements, 0 disables */
+static volatile uint16_t limit_echo;
+/* shrinking of the echo time in µs per s */
+static volatile uint32_t limit_approach;
+static uint16_t limit_motion;
+static volatile uint8_t limit_pending = 0;
+
+/* the last echo, for the rate of approach */
+static uint16_t last_echo;
+static uint16_t last_ms;
+static uint8_t last_valid = 0;
+
+/* optical counts since the start of the window */
+static uint16_t motion_counts;
+static uint16_t motion_start;
+
+/* raw measurements latched by the capture interrupt,
+ * converted by alarm_update()
+ */
+static volatile uint16_t latch_echo;
+static volatile uint16_t latch_delta;
+static volatile uint8_t latch_dt;
+static volatile uint8_t latch_pending = 0;
+/* set when the master clears the alarm */
+static volatile uint8_t cleared = 0;
+
+static void alarm_limits(void) {
+	struct alarm_sample_t l;
+	ATOMIC(ATOMIC_FORCEON) {
+		l = alarm_data->limit;
+		limit_pending = 0;
+	}
+	uint32_t echo = (uint32_t)l.distance * ALARM_US_PER_CM;
+	uint32_t approach = (uint32_t)l.approach * ALARM_US_PER_CM;
+	ATOMIC(ATOMIC_FORCEON) {
+		limit_echo = echo > UINT16_MAX ? UINT16_MAX : echo;
+		limit_approach = approach;
+	}
+	limit_motion = l.motion;
+}
+
+void alarm_init(struct alarm_data_t *output) {
+	alarm_data = output;
+	alarm_data->limit.distance = ALARM_DISTANCE;
+	alarm_data->limit.approach = ALARM_APPROACH;
+	alarm_data->limit.motion = ALARM_MOTION;
+	alarm_limits();
+	ALARM_PORT &= ~(1<<ALARM_BIT);
+	ALARM_DDR |= 1<<ALARM_BIT;
+}
+
+/* called from the TWI interrupt for every byte the master writes to
+ * the alarm registers
+ */
+void alarm_set(uint8_t reg, uint8_t value) {
+	if (reg < sizeof(struct alarm_sample_t)) {
+		((uint8_t *)&alarm_data->limit)[reg] = value;
+		if (reg & 1) {
+			limit_pending = 1;
+		}
+	} else if (reg == offsetof(struct alarm_data_t, flags)) {
+		ALARM_PORT &= ~(1<<ALARM_BIT);
+		alarm_data->flags = 0;
+		alarm_data->first = 0;
+		latch_pending = 0;
+		cleared = 1;
+	}
+}
+
+/* must be called with interrupts disabled,
+ * returns whether the alarm was raised by these comparators
+ */
+static uint8_t alarm_trip(uint8_t flags) {
+	uint8_t first = !alarm_data->flags;
+	alarm_data->flags |= flags;
+	if (first) {
+		alarm_data->first = flags;
+	}
+	return first;
+}
+
+/* called from the sonar capture interrupt with every echo time in µs */
+void alarm_echo(uint16_t echo) {
+	uint8_t flags = 0;
+	if (echo < limit_echo) {
+		ALARM_PORT |= 1<<ALARM_BIT;
+		flags = 1<<ALARM_FLAGS_DISTANCE;
+	}
+
+	struct tick_stamp_t now;
+	tick_stamp(&now);
+	uint16_t delta = 0;
+	uint8_t dt = 0;
+	if (last_valid && (uint16_t)(now.ms - last_ms) <= ALARM_MAX_INTERVAL) {
+		dt = now.ms - last_ms;
+		if (echo < last_echo) {
+			delta = last_echo - echo;
+		}
+		/* the echo time shrinks by delta µs in dt ms */
+		if (limit_approach && (uint32_t)delta * 1000 >= limit_approach * dt) {
+			ALARM_PORT |= 1<<ALARM_BIT;
+			flags |= 1<<ALARM_FLAGS_APPROACH;
+		}
+	}
+	last_echo = echo;
+	last_ms = now.ms;
+	last_valid = 1;
+
+	if (flags && alarm_trip(flags)) {
+		latch_echo = echo;
+		latch_delta = delta;
+		latch_dt = dt;
+		latch_pending = 1;
+	}
+}
+
+/* called from the sonar timeout interrupt when a ping went unanswered */
+void alarm_echo_lost(void) {
+	last_valid = 0;
+}
+
+/* called after every read of the optical sensor */
+void alarm_motion(int8_t dx, int8_t dy) {
+	uint16_t counts = motion_counts + abs(dx) + abs(dy);
+	/* saturate, the sensor may be read many times per window */
+	motion_counts = counts < motion_counts ? UINT16_MAX : counts;
+}
+
+#if USE_OPTICAL
+/* compares the counts of a full window against the motion threshold */
+static void alarm_motion_window(void) {
+	uint16_t dt = tick_now() - motion_start;
+	if (dt < ALARM_MOTION_WINDOW) {
+		return;
+	}
+	uint16_t counts = motion_counts;
+	motion_counts = 0;
+	motion_start += dt;
+	if (!limit_motion || (uint32_t)counts * 1000 < (uint32_t)limit_motion * dt) {
+		return;
+	}
+	ATOMIC(ATOMIC_FORCEON) {
+		ALARM_PORT |= 1<<ALARM_BIT;
+		if (alarm_trip(1<<ALARM_FLAGS_MOTION)) {
+			alarm_data->sample.distance = 0;
+			alarm_data->sample.approach = 0;
+			uint32_t rate = (uint32_t)counts * 1000 / dt;
+			alarm_data->sample.motion = rate > UINT16_MAX ? UINT16_MAX : rate;
+		}
+	}
+}
+#endif
+
+/* takes over new thresholds, compares the optical motion and converts
+ * the latched echo
+ */
+void alarm_update(void) {
+	if (limit_pending) {
+		alarm_limits();
+	}
+#if USE_OPTICAL
+	alarm_motion_window();
+#endif
+	if (!latch_pending) {
+		return;
+	}
+	uint16_t echo, delta;
+	uint8_t dt;
+	ATOMIC(ATOMIC_FORCEON) {
+		echo = latch_echo;
+		delta = latch_delta;
+		dt = latch_dt;
+		latch_pending = 0;
+		cleared = 0;
+	}
+	struct alarm_sample_t s;
+#if SLOPPY_SONAR_CONVERSION
+	s.distance = echo>>6;
+#else
+	s.distance = echo/58;
+#endif
+	s.approach = dt ? (uint32_t)delta * 1000 / ((uint16_t)ALARM_US_PER_CM * dt) : 0;
+	s.motion = 0;
+	ATOMIC(ATOMIC_FORCEON) {
+		/* unless the alarm was cleared or raised again meanwhile */
+		if (!latch_pending && !cleared) {
+			alarm_data->sample = s;
+		}
+	}
+}
+#endif
@@ -0,0 +1,11 @@
+/* threshold comparators driving the alarm output */
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+void alarm_init(struct alarm_data_t *output);
+void alarm_set(uint8_t reg, uint8_t value);
+void alarm_echo(uint16_t echo);
+void alarm_echo_lost(void);
+void alarm_motion(int8_t dx, int8_t dy);
+void alarm_update(void);
@@ -0,0 +1,315 @@
+#!/usr/bin/env python3
+"""Cycle accurate benchmark of the tiny-gps firmware.
+
+The ELF file is run in simulavr with a virtual GPS receiver feeding NMEA
+sentences into the UART, a sonar answering trigger pulses on the ICP pin,
+a bit level ADNS-5050 model on PA0/PA1/PB6 and an I2C master polling the
+register window at 400 kHz. Requires the simulavr python bindings
+(pysimulavr) and, for --matrix, avr-gcc.
+
+    bench.py [options] tiny-gps.elf
+    bench.py [options] --matrix bench/configs
+"""
+
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+import pysimulavr
+
+import peripherals
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+import regmap  # noqa: E402
+
+# interrupt vectors of the ATtiny2313/4313
+VECTORS = {
+    'sonar capture': 3,
+    'uart rx': 7,
+    'usi start': 15,
+    'usi overflow': 16,
+}
+
+
+class Layout(object):
+    """position of the registers the benchmark checks"""
+
+    def __init__(self, config):
+        regs = regmap.Layout(config)
+        self.lat = regs.offset('gps.lat')
+        self.distance = regs.offset('sonar.distance')
+        self.optical = regs.offset('optical.dx')
+        self.accu = regs.types['optical_accu_t']
+        self.version = regmap.VERSION
+        self.size = regs.offset('optical.flags')
+
+    def decode(self, data):
+        if data[0] != self.version:
+            raise SystemExit('register layout %d, expected %d'
+                             % (data[0], self.version))
+        frac = data[self.lat + 2:self.lat + 4]
+        seq = ((frac[0] & 0x0f) * 1000 + (frac[0] >> 4) * 100 +
+               (frac[1] & 0x0f) * 10 + (frac[1] >> 4))
+        fmt = '<ii' if self.accu == 4 else '<hh'
+        return {
+            'seq': seq,
+            'distance': struct.unpack_from('<h', data, self.distance)[0],
+            'flow': struct.unpack_from(fmt, data, self.optical),
+        }
+
+
+class Stats(object):
+    def __init__(self):
+        self.chars_sent = 0
+        self.rx_complete = None
+        self.capture_edge = None
+        self.gps_saturated = False
+        self.sent = {}
+        self.seen = set()
+        self.fix_latency = []
+        self.pings = 0
+        self.distances = []
+        self.flow_true = [0.0, 0.0]
+        self.flow_sensed = [0, 0]
+        self.flow_read = [0, 0]
+        self.optical_reads = 0
+        self.optical_writes = 0
+        self.stretch_total = 0
+        self.stretch_max = 0
+        self.polls = 0
+        self.nacks = 0
+        self.isr_entries = dict((k, 0) for k in VECTORS)
+        self.isr_latency = {'uart rx': [], 'sonar capture': []}
+
+    def sentence_sent(self, seq, t):
+        self.sent[seq % 10000] = t
+
+    def stretch(self, t):
+        self.stretch_total += t
+        self.stretch_max = max(self.stretch_max, t)
+
+    def registers(self, t, regs):
+        self.polls += 1
+        seq = regs['seq']
+        if seq in self.sent and seq not in self.seen:
+            self.seen.add(seq)
+            self.fix_latency.append(t - self.sent[seq])
+        self.distances.append(regs['distance'])
+        for i in range(2):
+            self.flow_read[i] += regs['flow'][i]
+
+    def isr(self, name, t):
+        self.isr_entries[name] += 1
+        edge = {'uart rx': self.rx_complete,
+                'sonar capture': self.capture_edge}.get(name)
+        if edge is not None:
+            self.isr_latency[name].append(t - edge)
+
+    def report(self, duration_ns, out=sys.stdout):
+        def us(v):
+            return '%.1f us' % (v / 1000.0)
+
+        def summary(values):
+            if not values:
+                return 'n/a'
+            return 'min %s, avg %s, max %s' % (
+                us(min(values)), us(sum(values) / len(values)), us(max(values)))
+
+        w = out.write
+        w('simulated time:          %s\n' % us(duration_ns))
+        w('characters sent:         %d\n' % self.chars_sent)
+        w('dropped characters:      %d\n' %
+          (self.chars_sent - self.isr_entries['uart rx']))
+        # the last sentences may still be in flight
+        lost = [s for s, t in self.sent.items() if s not in self.seen]
+        w('fixes sent/seen:         %d/%d\n' % (len(self.sent), len(self.seen)))
+        w('fixes never published:   %d\n' % max(0, len(lost) - 1))
+        w('fix-to-register latency: %s\n' % summary(self.fix_latency))
+        for name, values in sorted(self.isr_latency.items()):
+            w('%-24s %s\n' % ('%s latency:' % name, summary(values)))
+        for name, n in sorted(self.isr_entries.items()):
+            w('%-24s %d\n' % ('%s interrupts:' % name, n))
+        w('TWI polls/NACKs:         %d/%d\n' % (self.polls, self.nacks))
+        w('TWI clock stretching:    total %s, max %s\n' %
+          (us(self.stretch_total), us(self.stretch_max)))
+        w('sonar pings:             %d\n' % self.pings)
+        valid = [d for d in self.distances if d >= 0]
+        if valid:
+            w('sonar distance read:     %d..%d cm\n' % (min(valid), max(valid)))
+        w('optical reads/writes:    %d/%d\n' %
+          (self.optical_reads, self.optical_writes))
+        for i, axis in enumerate('xy'):
+            w('optical %s true/sensed/read: %d/%d/%d\n' %
+              (axis, self.flow_true[i], self.flow_sensed[i], self.flow_read[i]))
+        if self.gps_saturated:
+            w('warning: NMEA rate exceeds the baud rate\n')
+
+
+class Task(object):
+    def __init__(self, gen):
+        self.gen = gen
+        self.wake = 0
+        self.cond = None
+
+    def poll(self, now):
+        if self.cond is not None:
+            if not self.cond():
+                return
+        elif now < self.wake:
+            return
+        step = next(self.gen)
+        if callable(step):
+            self.cond = step
+        else:
+            self.cond = None
+            self.wake = now + step
+
+
+class Bench(object):
+    def __init__(self, elf, mcu, f_cpu):
+        self.sc = pysimulavr.SystemClock.Instance()
+        self.sc.ResetClock()
+        self.dev = pysimulavr.AvrFactory.instance().makeDevice(mcu)
+        self.dev.Load(elf)
+        self.dev.SetClockFreq(10**9 // f_cpu)
+        self.sc.Add(self.dev)
+        self.tasks = []
+        self.vectors = {}
+        for name, addr in symbols(elf).items():
+            m = re.match(r'__vector_(\d+)$', name)
+            if m:
+                for isr, n in VECTORS.items():
+                    if n == int(m.group(1)):
+                        self.vectors[addr // 2] = isr
+
+    def now(self):
+        return self.sc.GetCurrentTime()
+
+    def add(self, gen):
+        self.tasks.append(Task(gen))
+
+    def run(self, duration_ns, stats):
+        end = self.now() + duration_ns
+        pc = None
+        while self.now() < end:
+            self.sc.Step()
+            now = self.now()
+            if self.dev.PC != pc:
+                pc = self.dev.PC
+                isr = self.vectors.get(pc)
+                if isr:
+                    stats.isr(isr, now)
+            for t in self.tasks:
+                t.poll(now)
+
+
+def symbols(elf):
+    out = subprocess.check_output(['avr-nm', elf]).decode()
+    syms = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3:
+            syms[parts[2]] = int(parts[0], 16)
+    return syms
+
+
+def benchmark(elf, config, args, out=sys.stdout):
+    bench = Bench(elf, args.mcu, args.f_cpu)
+    stats = Stats()
+    layout = Layout(config)
+    if config.get('USE_GPS', 1):
+        rxd = peripherals.ExtPin(bench, 'D0', state='H')
+        bench.add(peripherals.gps(bench, rxd, config.get('GPS_BAUD', 38400),
+                                  args.nmea_rate, stats))
+    if config.get('USE_SONAR', 1):
+        trigger = peripherals.ExtPin(bench, 'D2', level=False)
+        echo = peripherals.ExtPin(bench, 'D6', state='L', level=False)
+        bench.add(peripherals.sonar(bench, trigger, echo, args.distance, stats))
+    if config.get('USE_OPTICAL', 1):
+        motion = None
+        if config.get('OPTICAL_MOTION_IRQ', 0):
+            motion = peripherals.ExtPin(bench, 'D3', state='H')
+        adns = peripherals.Adns5050(bench, args.flow, stats, motion)
+        bench.add(adns.run())
+    master = peripherals.I2CMaster(bench, config.get('TWIADDRESS', 0x11), stats)
+    # give the firmware some time to initialize before polling
+    bench.run(args.startup * 10**6, stats)
+    bench.add(master.poll(args.poll * 10**3, layout))
+    duration = args.duration * 10**6
+    bench.run(duration, stats)
+    stats.report(duration, out)
+
+
+def build(root, overrides):
+    """build the firmware with the given config.h overrides in a scratch
+    directory, returns the directory and the config"""
+    tmp = tempfile.mkdtemp(prefix='tiny-gps-bench-')
+    for f in os.listdir(root):
+        if f.endswith(('.c', '.h', '.mk', '.py')) or f == 'Makefile':
+            shutil.copy(os.path.join(root, f), tmp)
+    path = os.path.join(tmp, 'config.h')
+    with open(path) as f:
+        text = f.read()
+    for key, value in overrides:
+        text, n = re.subn(r'(?m)^#define %s .*$' % key,
+                          '#define %s %s' % (key, value), text)
+        if not n:
+            raise SystemExit('unknown option %s' % key)
+    with open(path, 'w') as f:
+        f.write(text)
+    subprocess.check_call(['make', '-s', '-C', tmp, 'elf'],
+                          stdout=subprocess.DEVNULL)
+    return tmp, regmap.read_config(path)
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument('elf', nargs='?', default='tiny-gps.elf')
+    p.add_argument('--mcu', default='attiny2313')
+    p.add_argument('--f-cpu', type=int, default=8000000)
+    p.add_argument('--config', default=None,
+                   help='config.h the ELF was built with')
+    p.add_argument('--matrix', default=None,
+                   help='file listing configurations to build and compare')
+    p.add_argument('--nmea-rate', type=int, default=10,
+                   help='GPS fixes per second')
+    p.add_argument('--distance', type=int, default=150,
+                   help='sonar distance in cm')
+    p.add_argument('--flow', type=float, nargs=2, default=[4.0, -2.5],
+                   help='optical flow in counts per ms')
+    p.add_argument('--poll', type=int, default=2000,
+                   help='TWI poll period in us')
+    p.add_argument('--startup', type=int, default=20,
+                   help='time before polling starts in ms')
+    p.add_argument('--duration', type=int, default=500,
+                   help='simulated time in ms')
+    args = p.parse_args()
+
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    if not args.matrix:
+        config = regmap.read_config(args.config or os.path.join(root, 'config.h'))
+        benchmark(args.elf, config, args)
+        return
+    with open(args.matrix) as f:
+        for line in f:
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            name, _, opts = line.partition(':')
+            overrides = [o.split('=', 1) for o in opts.split()]
+            tmp, config = build(root, overrides)
+            try:
+                sys.stdout.write('== %s\n' % name.strip())
+                benchmark(os.path.join(tmp, 'tiny-gps.elf'), config, args)
+                sys.stdout.write('\n')
+            finally:
+                shutil.rmtree(tmp)
+
+
+if __name__ == '__main__':
+    main()
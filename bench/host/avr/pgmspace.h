@@ -0,0 +1,10 @@
+/* flash access for host builds of the parser, see nmea_equiv.py */
+#include <stdint.h>
+#include <string.h>
+#define PROGMEM
+typedef const char *PGM_P;
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define strcmp_P(a, b) strcmp(a, b)
+#define memcpy_P(a, b, n) memcpy(a, b, n)
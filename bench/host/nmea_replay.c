@@ -0,0 +1,54 @@
+/* feeds NMEA sentences through nmea.c on the host and prints the GPS
+ * registers (and the sentence counters) after every line, see nmea_equiv.py
+ */
+#include <stdio.h>
+#include "nmea.h"
+
+static struct nav_data_t nav_data;
+
+static const char *sentences =
+	"$GPRMC,123519.00,A,4807.0381,N,01131.0002,E,022.4,084.4,230394,003.1,W*47\r\n"
+	"$GPGGA,123520,4807.0385,N,01131.0010,E,1,08,0.9,545.4,M,46.9,M,,*49\r\n"
+	"$GPRMC,123521,V,4807.0381,S,01131.0002,W,0.0,,240394,,*24\r\n"
+	"$GPGGA,123522,4807.0381,S,01131.0002,W,0,03,0.9,-12.25,M,46.9,M,,*60\r\n"
+	"$PMTK001,314,3*36\r\n"
+	"$PMTK001,,3*00\r\n"
+	"$GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74\r\n"
+	"$GPRMC,235959,A,0000.12345678901,N,18000.0000,E,,359.9,311299,,,A*61\r\n"
+	"$GPGGA,000001,0100.5,N,00200.25,W,2,12,0.9,7,M,46.9,M,,*7B\r\n"
+	"$GPGGA,000002,0200.5,S,00300.25,E,1,05,0.9,8,M,46.9,M,,\r\n"
+	"$GPRMC,000003,A,0300.5,N,00400.25,E,1.5,180.0,010100,,*00\r\n"
+	"$GPGGA,000004,0400.5,N,00500.25,E,1,07,0.9,100.5\r\n"
+	"$GPRMC,000005,A,0500.5,N,00600.2$GPRMC,000006,A,0600.5,N,00700.25,E,0.5,90.0,010100,,*00\r\n";
+
+int main(void) {
+	nmea_init(&nav_data.gps);
+#if USE_NMEA_STATS
+	nmea_stats_init(&nav_data.nmea_stats);
+#endif
+	for (const char *p = sentences; *p; p++) {
+		nmea_process_character(*p);
+		if (*p != '\n') {
+			continue;
+		}
+		const uint8_t *regs = (const uint8_t *)&nav_data.gps;
+		for (unsigned i = 0; i < sizeof(nav_data.gps); i++) {
+			printf("%02x", regs[i]);
+		}
+#if USE_NMEA_STATS
+		regs = (const uint8_t *)&nav_data.nmea_stats;
+		printf(" stats ");
+		for (unsigned i = 0; i < sizeof(nav_data.nmea_stats); i++) {
+			printf("%02x", regs[i]);
+		}
+#endif
+#if NMEA_PARSE_COURSE
+		printf(" course %u", nmea_course());
+#endif
+#if GPS_NEGOTIATE
+		printf(" ack %u", nmea_take_ack(314));
+#endif
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Compare the NMEA parser of two revisions on the host.
+
+nmea.c of both revisions is built with the host compiler for every
+configuration below, fed the sentences in host/nmea_replay.c, and the GPS
+registers printed after every line are compared. Refactorings of the parser
+must not change them.
+
+    nmea_equiv.py OLD [NEW]
+
+OLD and NEW are git revisions, NEW defaults to the working tree. Both need
+the register map generated by regmap.py.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+
+BENCH = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(BENCH)
+
+# config.h overrides, each one on top of the defaults
+CONFIGS = [
+    {},
+    {'PARSE_GPS_NMEA_GGA': 0},
+    {'PARSE_GPS_NMEA_RMC': 0},
+    {'PARSE_GPS_TIME': 0},
+    {'PARSE_GPS_ALTITUDE': 0},
+    {'GPS_NEGOTIATE': 1},
+    {'USE_FUSION': 1},
+    {'USE_FUSION': 1, 'PARSE_GPS_NMEA_GGA': 0},
+    {'USE_NMEA_STATS': 1},
+]
+
+
+def checkout(rev, dest):
+    """copy the sources of rev (None: working tree) to dest"""
+    if rev is None:
+        files = ['config.h', 'regmap.py', 'nmea.c', 'nmea.h']
+        for name in os.listdir(ROOT):
+            if name.endswith('.h'):
+                files.append(name)
+        for name in set(files):
+            with open(os.path.join(ROOT, name), 'rb') as src, \
+                    open(os.path.join(dest, name), 'wb') as dst:
+                dst.write(src.read())
+        return
+    archive = subprocess.run(['git', '-C', ROOT, 'archive', rev],
+                             check=True, capture_output=True).stdout
+    subprocess.run(['tar', '-x', '-C', dest], input=archive, check=True)
+
+
+def configure(src, overrides):
+    path = os.path.join(src, 'config.h')
+    with open(path) as f:
+        lines = f.read().split('\n')
+    for i, line in enumerate(lines):
+        words = line.split()
+        if len(words) >= 3 and words[0] == '#define' and words[1] in overrides:
+            lines[i] = '#define %s %d' % (words[1], overrides[words[1]])
+    with open(path, 'w') as f:
+        f.write('\n'.join(lines))
+    with open(os.path.join(src, 'regmap.h'), 'w') as f:
+        subprocess.run([sys.executable, 'regmap.py', '--firmware'],
+                       cwd=src, stdout=f, check=True)
+
+
+def replay(src):
+    exe = os.path.join(src, 'replay')
+    subprocess.run(['gcc', '-std=gnu99', '-funsigned-char', '-fpack-struct',
+                    '-fshort-enums', '-DF_CPU=8000000UL', '-w',
+                    '-isystem', os.path.join(BENCH, 'host'), '-I', src,
+                    '-o', exe, os.path.join(src, 'nmea.c'),
+                    os.path.join(BENCH, 'host', 'nmea_replay.c')],
+                   check=True)
+    return subprocess.run([exe], check=True, capture_output=True,
+                          text=True).stdout
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(__doc__)
+    old = sys.argv[1]
+    new = sys.argv[2] if len(sys.argv) == 3 else None
+    failed = 0
+    for overrides in CONFIGS:
+        outputs = []
+        for rev in (old, new):
+            with tempfile.TemporaryDirectory() as src:
+                checkout(rev, src)
+                configure(src, overrides)
+                outputs.append(replay(src))
+        name = ' '.join('%s=%d' % kv for kv in sorted(overrides.items()))
+        same = outputs[0] == outputs[1]
+        print('%-40s %s' % (name or 'defaults', 'same' if same else 'DIFFERENT'))
+        if not same:
+            failed = 1
+            for a, b in zip(outputs[0].splitlines(), outputs[1].splitlines()):
+                if a != b:
+                    print('  - %s\n  + %s' % (a, b))
+    sys.exit(failed)
+
+
+if __name__ == '__main__':
+    main()
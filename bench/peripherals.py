@@ -0,0 +1,309 @@
+"""Virtual peripherals attached to the simulated tiny-gps controller.
+
+All peripherals are either coroutines run by Bench (yielding a delay in ns
+or a condition to wait for) or react on pin changes reported by simulavr.
+"""
+
+import pysimulavr
+
+# 400 kHz fast mode bus timing (ns)
+I2C_T_LOW = 1300
+I2C_T_HIGH = 1200
+I2C_T_SU = 100
+
+
+class ExtPin(pysimulavr.Pin):
+    """A pin of an external device, connected to a pin of the controller."""
+
+    def __init__(self, bench, name, state='t', level=True, on_change=None):
+        pysimulavr.Pin.__init__(self)
+        self.bench = bench
+        self.level = level
+        self.on_change = on_change
+        # keep a reference to the net, it must outlive this constructor
+        self.net = pysimulavr.Net()
+        self.net.Add(self)
+        self.net.Add(bench.dev.GetPin(name))
+        self.SetPin(state)
+
+    def SetInState(self, pin):
+        pysimulavr.Pin.SetInState(self, pin)
+        level = pin.toChar() in 'Hh'
+        if level != self.level:
+            self.level = level
+            if self.on_change:
+                self.on_change(level)
+
+    def drive(self, level):
+        self.SetPin('H' if level else 'L')
+
+    def release(self):
+        self.SetPin('t')
+
+    def pullup(self):
+        self.SetPin('h')
+
+
+def nmea_checksum(body):
+    cs = 0
+    for c in body.encode():
+        cs ^= c
+    return '$%s*%02X\r\n' % (body, cs)
+
+
+def nmea_source(rate_hz):
+    """Yield (delay, sentence bytes, sequence number) for an endless stream
+    of GGA/RMC pairs. The sequence number is encoded in the fraction of the
+    latitude minutes, so the master can tell which fix it is reading."""
+    seq = 0
+    while True:
+        secs = seq // rate_hz
+        hms = '%02d%02d%02d.%02d' % (secs // 3600 % 24, secs // 60 % 60,
+                                    secs % 60, seq % rate_hz * 100 // rate_hz)
+        lat = '4807.%04d' % (seq % 10000)
+        gga = nmea_checksum('GPGGA,%s,%s,N,01131.0000,E,1,08,0.9,545.4,M,46.9,M,,'
+                            % (hms, lat))
+        rmc = nmea_checksum('GPRMC,%s,A,%s,N,01131.0000,E,022.4,084.4,230394,003.1,W'
+                            % (hms, lat))
+        yield (gga + rmc).encode(), seq
+        seq += 1
+
+
+def gps(bench, pin, baud, rate_hz, stats):
+    """Serial GPS receiver sending NMEA sentences at the given rate."""
+    bit = 10**9 / baud
+    period = 10**9 // rate_hz
+    pin.drive(1)
+    for data, seq in nmea_source(rate_hz):
+        start = bench.now()
+        for b in data:
+            for level in [0] + [(b >> i) & 1 for i in range(8)] + [1]:
+                pin.drive(level)
+                yield int(bit)
+            # the receiver completes the character in the stop bit
+            stats.rx_complete = bench.now() - int(bit / 2)
+            stats.chars_sent += 1
+        stats.sentence_sent(seq, bench.now())
+        idle = period - (bench.now() - start)
+        if idle > 0:
+            yield idle
+        else:
+            stats.gps_saturated = True
+
+
+def sonar(bench, trigger, echo, distance_cm, stats):
+    """Ultrasonic sensor answering every trigger pulse with an echo."""
+    echo.drive(0)
+    while True:
+        yield lambda: trigger.level
+        yield lambda: not trigger.level
+        yield 200000
+        echo.drive(1)
+        stats.capture_edge = bench.now()
+        yield distance_cm * 58 * 1000
+        echo.drive(0)
+        stats.capture_edge = bench.now()
+        stats.pings += 1
+
+
+class Adns5050(object):
+    """Bit level model of the ADNS-5050 optical sensor's serial port."""
+
+    MOTION = 0x02
+    DELTA_X = 0x03
+    DELTA_Y = 0x04
+    PIXEL_GRAB = 0x0b
+
+    def __init__(self, bench, flow, stats, motion_pin=None):
+        self.bench = bench
+        self.flow = flow  # counts per ms in x and y
+        self.stats = stats
+        self.regs = {0x00: 0x12, 0x05: 0x40, 0x06: 0x01, 0x07: 0x80,
+                     0x08: 0x60, 0x0a: 0x08, 0x0d: 0x00, 0x19: 0x04}
+        self.acc = [0.0, 0.0]
+        self.latched = [0, 0]
+        self.last = 0
+        self.pixel = 0
+        self.ncs = ExtPin(bench, 'B6', on_change=self.on_ncs)
+        self.sdio = ExtPin(bench, 'A1')
+        self.sclk = ExtPin(bench, 'A0', on_change=self.on_sclk)
+        self.motion_pin = motion_pin
+        self.reset()
+
+    def reset(self):
+        self.phase = 'addr'
+        self.shift = 0
+        self.bits = 0
+        self.addr = 0
+
+    def integrate(self):
+        now = self.bench.now()
+        dt = (now - self.last) / 1e6
+        self.last = now
+        for i in range(2):
+            self.acc[i] += self.flow[i] * dt
+            self.stats.flow_true[i] += self.flow[i] * dt
+        if self.motion_pin:
+            self.motion_pin.drive(not self.pending())
+
+    def pending(self):
+        return abs(self.acc[0]) >= 1 or abs(self.acc[1]) >= 1
+
+    def read(self, addr):
+        self.integrate()
+        if addr == self.MOTION:
+            if not self.pending():
+                return 0
+            for i in range(2):
+                d = max(-128, min(127, int(self.acc[i])))
+                self.acc[i] -= d
+                self.latched[i] = d
+            return 0x80
+        if addr in (self.DELTA_X, self.DELTA_Y):
+            i = addr - self.DELTA_X
+            d, self.latched[i] = self.latched[i], 0
+            self.stats.flow_sensed[i] += d
+            return d & 0xff
+        if addr == self.PIXEL_GRAB:
+            self.pixel = (self.pixel + 1) % 361
+            return 0x80 | (self.pixel & 0x7f)
+        return self.regs.get(addr, 0)
+
+    def on_ncs(self, level):
+        self.sdio.release()
+        self.reset()
+
+    def on_sclk(self, level):
+        if self.ncs.level:
+            return
+        if level and self.phase in ('addr', 'write'):
+            # the controller's data is sampled on the rising edge
+            self.shift = (self.shift << 1 | self.sdio.level) & 0xff
+            self.bits += 1
+            if self.bits < 8:
+                return
+            self.bits = 0
+            if self.phase == 'write':
+                self.regs[self.addr] = self.shift
+                self.stats.optical_writes += 1
+                self.phase = 'addr'
+            elif self.shift & 0x80:
+                self.addr = self.shift & 0x7f
+                self.phase = 'write'
+            else:
+                self.addr = self.shift
+                self.shift = self.read(self.addr)
+                self.phase = 'read'
+                self.stats.optical_reads += 1
+        elif not level and self.phase == 'read':
+            # our data changes on the falling edge
+            self.sdio.drive((self.shift >> (7 - self.bits)) & 1)
+            self.bits += 1
+            if self.bits == 8:
+                self.phase = 'done'
+
+    def run(self):
+        """coroutine updating the MOTION output"""
+        while True:
+            self.integrate()
+            yield 100000
+
+
+class I2CMaster(object):
+    """Bus master polling the register window of the controller."""
+
+    def __init__(self, bench, address, stats):
+        self.bench = bench
+        self.address = address
+        self.stats = stats
+        self.scl = ExtPin(bench, 'B7', state='h')
+        self.sda = ExtPin(bench, 'B5', state='h')
+
+    def scl_high(self):
+        self.scl.pullup()
+        t = self.bench.now()
+        yield 1
+        if not self.scl.level:
+            # the slave is stretching the clock
+            yield lambda: self.scl.level
+        self.stats.stretch(self.bench.now() - t)
+
+    def start(self):
+        self.sda.pullup()
+        yield I2C_T_LOW
+        yield from self.scl_high()
+        yield I2C_T_HIGH
+        self.sda.drive(0)
+        yield I2C_T_HIGH
+        self.scl.drive(0)
+        yield I2C_T_SU
+
+    def stop(self):
+        self.sda.drive(0)
+        yield I2C_T_LOW
+        yield from self.scl_high()
+        yield I2C_T_HIGH
+        self.sda.pullup()
+        yield I2C_T_HIGH
+
+    def bit_out(self, b):
+        if b:
+            self.sda.pullup()
+        else:
+            self.sda.drive(0)
+        yield I2C_T_LOW
+        yield from self.scl_high()
+        yield I2C_T_HIGH
+        self.scl.drive(0)
+        yield I2C_T_SU
+
+    def bit_in(self, result):
+        self.sda.pullup()
+        yield I2C_T_LOW
+        yield from self.scl_high()
+        yield I2C_T_HIGH // 2
+        result.append(self.sda.level)
+        yield I2C_T_HIGH // 2
+        self.scl.drive(0)
+        yield I2C_T_SU
+
+    def write_byte(self, value):
+        for i in range(7, -1, -1):
+            yield from self.bit_out((value >> i) & 1)
+        ack = []
+        yield from self.bit_in(ack)
+        return not ack[0]
+
+    def read_byte(self, last):
+        bits = []
+        for i in range(8):
+            yield from self.bit_in(bits)
+        yield from self.bit_out(last)
+        return sum(b << (7 - i) for i, b in enumerate(bits))
+
+    def read(self, offset, n):
+        """read n bytes starting at offset, returns None on NACK"""
+        yield from self.start()
+        ok = yield from self.write_byte(self.address << 1)
+        ok = ok and (yield from self.write_byte(offset))
+        data = None
+        if ok:
+            yield from self.start()
+            if (yield from self.write_byte(self.address << 1 | 1)):
+                data = []
+                for i in range(n):
+                    data.append((yield from self.read_byte(i == n - 1)))
+        yield from self.stop()
+        return data
+
+    def poll(self, period_ns, layout):
+        while True:
+            t = self.bench.now()
+            data = yield from self.read(0, layout.size)
+            if data is None:
+                self.stats.nacks += 1
+            else:
+                self.stats.registers(self.bench.now(), layout.decode(bytes(data)))
+            idle = period_ns - (self.bench.now() - t)
+            if idle > 0:
+                yield idle
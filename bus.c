@@ -0,0 +1,98 @@
+#include "config.h"
+#if TWI_ADDRESS_STRAPS || USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+/* TWI address selection and general call commands */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/delay.h>
+#include "hal.h"
+#include "tick.h"
+#include "persist.h"
+#include "bus.h"
+
+#if TWI_ADDRESS_STRAPS > 2
+	#error "at most two TWI address straps are supported"
+#endif
+
+#define STRAP_MASK (((1<<TWI_ADDRESS_STRAPS)-1) << ADDR_STRAP_BIT)
+
+/* addresses below and above are reserved by the I²C specification */
+#define BUS_ADDRESS_VALID(a) ((a) >= 0x08 && (a) <= 0x77)
+
+/* the address set at build time and by the straps */
+static uint8_t default_address;
+/* the address answered to after a reset */
+static uint8_t boot_address;
+
+#if USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+static struct bus_data_t *bus_data;
+#endif
+
+/* the address to answer to after a reset, call once */
+uint8_t bus_address(void) {
+	default_address = TWIADDRESS;
+#if TWI_ADDRESS_STRAPS
+	/* pull-ups on, a strap to ground sets its bit */
+	ADDR_STRAP_DDR &= ~STRAP_MASK;
+	ADDR_STRAP_PORT |= STRAP_MASK;
+	_delay_us(10);
+	default_address += (~ADDR_STRAP_PIN & STRAP_MASK) >> ADDR_STRAP_BIT;
+#endif
+	boot_address = default_address;
+#if USE_TWI_ADDRESS_SET && USE_PERSIST
+	/* an address set by the master takes precedence */
+	if (persist_last() && BUS_ADDRESS_VALID(persist_last()->address)) {
+		boot_address = persist_last()->address;
+	}
+#endif
+	return boot_address;
+}
+
+#if USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+void bus_init(struct bus_data_t *output) {
+	bus_data = output;
+#if USE_TWI_ADDRESS_SET
+	bus_data->address = boot_address;
+	bus_data->confirm = 0;
+#endif
+}
+#endif
+
+#if USE_TWI_ADDRESS_SET
+/* called from the TWI interrupt for every byte the master writes to the
+ * address registers
+ */
+void bus_set(uint8_t reg, uint8_t value) {
+	static uint8_t requested;
+	if (reg == offsetof(struct bus_data_t, address)) {
+		requested = value;
+		return;
+	}
+	if (reg != offsetof(struct bus_data_t, confirm) || value != (uint8_t)~requested) {
+		return;
+	}
+	uint8_t address = requested ? requested : default_address;
+	if (!BUS_ADDRESS_VALID(address)) {
+		return;
+	}
+	/* the ongoing transfer goes on, the next one is addressed anew */
+	twiSlaveSetAddress(address);
+	bus_data->address = address;
+#if USE_PERSIST
+	persist_set_address(requested ? requested : PERSIST_NONE);
+#endif
+}
+#endif
+
+#if TWI_GENERAL_CALL
+/* called from the TWI interrupt after a latch command */
+void bus_latched(void) {
+	struct tick_stamp_t now;
+	tick_stamp(&now);
+	bus_data->latch_ms = now.ms;
+	bus_data->latch_sub = now.sub;
+	bus_data->latches++;
+}
+#endif
+#endif
@@ -0,0 +1,11 @@
+/* TWI address selection and general call commands */
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+uint8_t bus_address(void);
+#if USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+void bus_init(struct bus_data_t *output);
+#endif
+void bus_set(uint8_t reg, uint8_t value);
+void bus_latched(void);
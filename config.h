@@ -1,6 +1,43 @@
 /* 7 bit address on the TWI/I²C bus */
 #define TWIADDRESS 0x11
 
+/* release the bus when a transfer stands still?
+ *
+ * A master reset in the middle of a transfer can leave the slave holding
+ * SDA low, which blocks the bus for every device on it until a power cycle.
+ * With USE_TWI_WATCHDOG, a transfer that holds SDA or SCL low without a
+ * single clock for TWI_STUCK_TIMEOUT to twice that many ms (SMBus allows
+ * 35 ms) is abandoned and the lines are released. The USI driver also stops
+ * waiting for a start condition to complete after about 1 ms. Recoveries
+ * are counted and offered via TWI.
+ */
+#define USE_TWI_WATCHDOG 0
+#define TWI_STUCK_TIMEOUT 35
+
+/* number of strap pins added to TWIADDRESS (0 to 2)
+ *
+ * A pin tied to ground sets its bit, so boards on the same bus can run the
+ * same firmware. See 'hal.h' for the pins.
+ */
+#define TWI_ADDRESS_STRAPS 0
+
+/* may the master change the TWI address?
+ *
+ * Writing the new address followed by its complement to the address
+ * register takes effect after the transfer; with USE_PERSIST it is kept in
+ * the EEPROM and takes precedence over TWIADDRESS and the straps.
+ */
+#define USE_TWI_ADDRESS_SET 0
+
+/* answer general calls (address 0)?
+ *
+ * 0 ignores them. 1 takes their first byte as a command: TWI_GCALL_LATCH
+ * latches the optical motion and the PPS offset of every controller on the
+ * bus at the same instant and records the time, the master then reads the
+ * boards one after the other. General calls never change registers.
+ */
+#define TWI_GENERAL_CALL 0
+
 /* query a serial GPS? */
 #define USE_GPS 1
 
@@ -23,6 +60,84 @@
 /* use a different baud rate for sending the init string? */
 //#define GPS_INIT_BAUD 9600
 
+/* detect the baud rate of the GPS receiver?
+ *
+ * Starting with GPS_BAUD, the standard baud rates are probed for
+ * GPS_AUTOBAUD_PROBE_TIME ms each until a sentence with a valid checksum is
+ * received. Afterwards, the receiver is switched (using PMTK251) to the
+ * fastest rate up to GPS_AUTOBAUD_MAX that can be generated accurately at
+ * F_CPU; if it does not answer at the new rate, the detected one is kept.
+ * The init string is sent at the detected rate, GPS_INIT_BAUD is ignored.
+ * GPS_BAUD has to be one of the standard rates from 4800 to 115200 baud.
+ */
+#define GPS_AUTOBAUD 0
+#define GPS_AUTOBAUD_PROBE_TIME 1500
+#define GPS_AUTOBAUD_MAX 115200
+
+/* negotiate the output of the GPS receiver?
+ *
+ * Only the sentences parsed (see PARSE_GPS_NMEA_*) are enabled using PMTK314
+ * and the fix interval is set to GPS_UPDATE_INTERVAL ms (PMTK220, PMTK300
+ * for older firmware; 0 keeps the receiver's default). Every command is
+ * repeated until the receiver acknowledges it with $PMTK001, it is sent at
+ * most GPS_NEGOTIATE_RETRIES times, waiting GPS_ACK_TIMEOUT ms for each answer.
+ * If the receiver later emits sentences that were not enabled, it has
+ * fallen back to its defaults and the negotiation starts over.
+ */
+#define GPS_NEGOTIATE 0
+#define GPS_UPDATE_INTERVAL 200
+#define GPS_NEGOTIATE_RETRIES 3
+#define GPS_ACK_TIMEOUT 1000
+
+/* timestamp the PPS output of the GPS receiver?
+ *
+ * The pulse must be connected to PB0 (PCINT0); the time of the following
+ * sentence is attributed to it. Requires PARSE_GPS_TIME.
+ */
+#define USE_PPS 0
+
+/* propagate the GPS position by the optical motion between fixes?
+ *
+ * The optical sensor has to look down, its y axis pointing forward; the
+ * motion is turned to north/east by the course from RMC and scaled by the
+ * height measured by the sonar (FUSION_DEFAULT_HEIGHT cm without it).
+ * FUSION_FLOW_SCALE is the number of counts per cm of ground travelled at
+ * a height of 1 cm, which depends on the optics and OPTICAL_RESOLUTION.
+ * The offsets are updated every FUSION_PERIOD ms and the confidence drops
+ * by one every FUSION_CONFIDENCE_DECAY ms after a fix.
+ */
+#define USE_FUSION 0
+#define FUSION_PERIOD 20
+#define FUSION_FLOW_SCALE 1000
+#define FUSION_DEFAULT_HEIGHT 100
+#define FUSION_CONFIDENCE_DECAY 20
+
+/* offer the position as east/north/up offsets from an origin in cm?
+ *
+ * The master writes the origin in the format of the GPS registers (flags,
+ * latitude, longitude, altitude); the offsets are 32 bit wide unless
+ * ENU_OFFSET_32BIT is disabled, which saturates them at about 327 m.
+ * Offsets beyond about 80 km (45 minutes) saturate in any case.
+ */
+#define USE_ENU 0
+#define ENU_OFFSET_32BIT 1
+
+/* keep data across power cycles in the EEPROM?
+ *
+ * The detected baud rate (GPS_AUTOBAUD) and the optical sensor configuration
+ * set over TWI are stored. The records rotate through the EEPROM to spread
+ * the wear. On boot the receiver is tried at the stored rate first.
+ *
+ * With PERSIST_AIDING, the last valid fix is stored as well, at most every
+ * PERSIST_FIX_INTERVAL seconds, and handed to the receiver on boot as aiding
+ * data (PMTK741), which needs PARSE_GPS_TIME. The command always carries the
+ * time, and as we have no clock it is the time of the stored fix: enable it
+ * only if power losses are short, as stale time aiding slows the first fix.
+ */
+#define USE_PERSIST 0
+#define PERSIST_AIDING 0
+#define PERSIST_FIX_INTERVAL 300
+
 /* query additional sonar device?
  *
  * The sonar trigger must be connected to PD5, the echo wire to the ICP pin.
@@ -36,6 +151,50 @@
  */
 #define USE_OPTICAL 1
 
+/* use 32 bit accumulators for the optical flow sensor?
+ *
+ * The movement counters saturate instead of wrapping around; with 16 bit
+ * counters, the master has to poll at least every few thousand counts.
+ */
+#define OPTICAL_ACCU_32BIT 0
+
+/* resolution of the optical flow sensor in steps of 125 cpi (1 to 11)
+ *
+ * Higher resolutions are more precise but saturate the movement counters
+ * sooner; the master can change the resolution at runtime.
+ */
+#define OPTICAL_RESOLUTION 4
+
+/* keep the optical flow sensor from entering its power saving rest modes? */
+#define OPTICAL_FORCE_AWAKE 0
+
+/* only query the optical flow sensor when it signals motion?
+ *
+ * The MOTION output of the sensor must be connected to PD3 (INT1).
+ */
+#define OPTICAL_MOTION_IRQ 0
+
+/* limit the rate (in Hz) of optical sensor queries?
+ *
+ * 0 queries the sensor whenever there is time left.
+ */
+#define OPTICAL_MAX_RATE 0
+
+/* offer diagnostic data of the optical sensor?
+ *
+ * Surface quality, shutter time and pixel statistics are read every
+ * OPTICAL_DIAG_INTERVAL ms; the master can also grab entire frames of the
+ * sensor's pixel array.
+ */
+#define USE_OPTICAL_DIAG 0
+#define OPTICAL_DIAG_INTERVAL 100
+
+/* use the hardware SPI for the optical sensor (ATmega parts only)?
+ *
+ * SDIO is connected to MOSI and, through a 1k resistor, to MISO.
+ */
+#define OPTICAL_HW_SPI 0
+
 /* employ an LED to indicate a GPS fix?
  *
  * The LED must be connected to PD5 and GND.
@@ -64,6 +223,40 @@
 #define PARSE_GPS_NMEA_GGA 1
 #define PARSE_GPS_NMEA_RMC 1
 
+/* count the NMEA sentences and the errors of the serial link?
+ *
+ * For RMC, GGA and all other sentences, the received and accepted sentences,
+ * checksum failures, missing checksums and fields truncated by the parser are
+ * counted; so are sentences cut short by the start of the next one. The
+ * counters wrap around, the master is expected to look at their differences.
+ */
+#define USE_NMEA_STATS 0
+
+/* stream the measurements on the UART transmitter?
+ *
+ * Once the receiver has been initialized, TELEMETRY_RATE times per second
+ * a binary record of the GPS, sonar and optical data is sent on TX at
+ * GPS_BAUD, framed and protected by a CRC (see telemetry_record_t in
+ * regmap.py). Records not fitting into the bandwidth are dropped. TX then
+ * has to be connected to the logger or radio instead of the receiver, so
+ * GPS_NEGOTIATE cannot be used; init strings and aiding data are still sent
+ * at boot. GPS_AUTOBAUD cannot be used either, as it leaves the UART at
+ * whatever rate the receiver runs at. The transmit buffer needs the SRAM of
+ * an ATmega part.
+ */
+#define USE_TELEMETRY 0
+#define TELEMETRY_RATE 10
+
+/* forward data written over TWI to the GPS receiver?
+ *
+ * Bytes the master writes to the FIFO register (e.g. RTCM corrections or
+ * PMTK commands) are sent to the receiver by the UART transmit interrupt,
+ * without delaying sentences of GPS_NEGOTIATE. The master reads how many
+ * bytes the FIFO can take; a byte it cannot take is not acknowledged. Uses
+ * the transmitter just like USE_TELEMETRY, so only one of them can be used.
+ */
+#define USE_GPS_FORWARD 0
+
 /* sloppy sonar distance conversion?
  *
  * When enabled, the echo time of the sonar pulse will be divided by 64 instead
@@ -80,3 +273,48 @@
  * Changing this value to 1 disables the sliding window and reduces the memory footprint.
  */
 #define SONAR_AVG_WINDOW_SIZE 5
+
+/* interval (in ms) between sonar pings
+ *
+ * A new ping is only sent after the echo of the last one has been received or
+ * timed out.
+ */
+#define SONAR_PERIOD 10
+
+/* raise an alarm output when an obstacle comes close?
+ *
+ * Every sonar echo is compared against a minimum distance (ALARM_DISTANCE
+ * cm) and a maximum rate of approach (ALARM_APPROACH cm/s) right in the
+ * capture interrupt, before any averaging; the optical counts are added up
+ * over 100 ms windows and compared against a maximum motion (ALARM_MOTION
+ * counts/s, x and y added up). A tripped comparator drives PD4 high and
+ * latches the measurements that tripped it until the master clears the
+ * alarm. 0 disables a comparator; the master can change the thresholds at
+ * runtime.
+ */
+#define USE_ALARM 0
+#define ALARM_DISTANCE 30
+#define ALARM_APPROACH 0
+#define ALARM_MOTION 0
+
+/* shed low priority work (like optical sensor queries) while at least this
+ * many received GPS characters are waiting to be parsed
+ */
+#define SCHED_SHED_WATERMARK 2
+
+/* put the controller to sleep while there is nothing to do?
+ *
+ * The controller idles until the next interrupt; the wake up sources are
+ * counted and offered via TWI. Optical sensor queries keep it awake unless
+ * OPTICAL_MOTION_IRQ or OPTICAL_MAX_RATE are used.
+ */
+#define USE_SLEEP 0
+
+/* measure execution times?
+ *
+ * Minimum, maximum and average durations of the interrupt handlers, the main
+ * loop passes and the scheduled tasks are offered via TWI. The measurement
+ * itself adds a few microseconds to each section, and the statistics need
+ * 91 bytes of SRAM (6 per profiled section, see PROFILE_SLOTS in regmap.py).
+ */
+#define USE_PROFILER 0
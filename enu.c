@@ -0,0 +1,129 @@
+#include "config.h"
+#if USE_ENU
+/* offsets from a local origin */
+#include <stdlib.h>
+#include <stdint.h>
+#include "nmea.h"
+#include "enu.h"
+#include "trig.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+#if NMEA_MINUTE_FRACTS != 4 || NMEA_ALTITUDE_FRACTS != 2
+	#error "USE_ENU expects the default number of fractional digits"
+#endif
+
+/* 1/10000 of a minute of latitude is 18.52 cm, times 256 */
+#define ENU_LAT_SCALE 4741
+/* larger differences (about 45 minutes) overflow the scaling */
+#define ENU_MAX_UNITS 450000L
+
+static struct enu_data_t *enu_data;
+
+/* origin in 1/10000 minutes and cm */
+static int32_t origin_lat;
+static int32_t origin_lon;
+static int32_t origin_alt;
+/* cm per 1/10000 minute of longitude at the origin, times 256 */
+static uint16_t lon_scale;
+static uint8_t origin_set = 0;
+
+static volatile uint8_t origin_pending = 0;
+static volatile uint8_t fix_pending = 0;
+static uint8_t saturated;
+
+static int32_t enu_units(const struct coord *co, uint8_t positive) {
+	/* the fractions are BCD, least significant nibble first */
+	int32_t v = ((int32_t)co->deg*60 + co->min) * 10000 +
+		(co->frac[0] & 0x0F)*1000 + (co->frac[0]>>4)*100 +
+		(co->frac[1] & 0x0F)*10 + (co->frac[1]>>4);
+	return positive ? v : -v;
+}
+
+static int32_t enu_cm(const struct altitude_t *alt) {
+	uint8_t frac = (alt->frac[0] & 0x0F)*10 + (alt->frac[0]>>4);
+	int32_t cm = (int32_t)alt->m * 100;
+	return alt->m < 0 ? cm - frac : cm + frac;
+}
+
+static enu_offset_t enu_scale(int32_t units, uint16_t scale) {
+	if (units > ENU_MAX_UNITS || units < -ENU_MAX_UNITS) {
+		saturated = 1;
+		return units > 0 ? ENU_OFFSET_MAX : -ENU_OFFSET_MAX;
+	}
+	int32_t cm = (units * scale) >> 8;
+	if (cm > ENU_OFFSET_MAX || cm < -ENU_OFFSET_MAX) {
+		saturated = 1;
+		return cm > 0 ? ENU_OFFSET_MAX : -ENU_OFFSET_MAX;
+	}
+	return cm;
+}
+
+void enu_init(struct enu_data_t *output) {
+	enu_data = output;
+}
+
+/* called from the TWI interrupt for every byte the master writes to
+ * the origin registers
+ */
+void enu_set_origin(uint8_t reg, uint8_t value) {
+	((uint8_t *)&enu_data->origin)[reg] = value;
+	if (reg == sizeof(struct enu_origin_t) - 1) {
+		origin_pending = 1;
+	}
+}
+
+/* a new position has been parsed */
+void enu_fix(void) {
+	fix_pending = 1;
+}
+
+void enu_update(const struct nmea_data_t *fix) {
+	if (origin_pending) {
+		/* everything depending on the origin is computed only once */
+		struct enu_origin_t o;
+		ATOMIC(ATOMIC_FORCEON) {
+			o = enu_data->origin;
+			origin_pending = 0;
+		}
+		origin_lat = enu_units(&o.lat, o.flags & 1<<NMEA_RMC_FLAGS_LAT_NORTH);
+		origin_lon = enu_units(&o.lon, o.flags & 1<<NMEA_RMC_FLAGS_LON_EAST);
+		origin_alt = enu_cm(&o.alt);
+		lon_scale = ((int32_t)ENU_LAT_SCALE * trig_cos(o.lat.deg, o.lat.min)) >> 15;
+		origin_set = 1;
+		fix_pending = 1;
+	}
+	if (!fix_pending) {
+		return;
+	}
+	fix_pending = 0;
+
+	saturated = 0;
+	enu_offset_t north = enu_scale(enu_units(&fix->lat, fix->flags & 1<<NMEA_RMC_FLAGS_LAT_NORTH) - origin_lat, ENU_LAT_SCALE);
+	enu_offset_t east = enu_scale(enu_units(&fix->lon, fix->flags & 1<<NMEA_RMC_FLAGS_LON_EAST) - origin_lon, lon_scale);
+	int32_t up = enu_cm(&fix->alt) - origin_alt;
+	if (up > ENU_OFFSET_MAX || up < -ENU_OFFSET_MAX) {
+		saturated = 1;
+		up = up > 0 ? ENU_OFFSET_MAX : -ENU_OFFSET_MAX;
+	}
+
+	uint8_t flags = 0;
+	if (origin_set && fix->flags & 1<<NMEA_RMC_FLAGS_STATUS_OK) {
+		flags |= 1<<ENU_FLAGS_VALID;
+	}
+	if (saturated) {
+		flags |= 1<<ENU_FLAGS_SATURATED;
+	}
+	ATOMIC(ATOMIC_FORCEON) {
+		enu_data->east = east;
+		enu_data->north = north;
+		enu_data->up = up;
+		enu_data->flags = flags;
+	}
+}
+#endif
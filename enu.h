@@ -0,0 +1,9 @@
+/* local east/north/up offsets */
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+void enu_init(struct enu_data_t *output);
+void enu_set_origin(uint8_t reg, uint8_t value);
+void enu_fix(void);
+void enu_update(const struct nmea_data_t *fix);
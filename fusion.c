@@ -0,0 +1,138 @@
+#include "config.h"
+#if USE_FUSION
+/* dead reckoning between GPS fixes */
+#include <stdlib.h>
+#include <stdint.h>
+#include "nmea.h"
+#include "optical.h"
+#include "fusion.h"
+#include "tick.h"
+#include "trig.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+#if !USE_OPTICAL || !PARSE_GPS_NMEA_RMC
+	#error "USE_FUSION requires USE_OPTICAL and PARSE_GPS_NMEA_RMC"
+#endif
+
+/* the age stops here, before the tick wraps around */
+#define FUSION_MAX_AGE 60000
+/* limits keeping the intermediate products within 32 bit */
+#define FUSION_MAX_COUNTS 4096
+#define FUSION_MAX_HEIGHT 500
+
+static struct fusion_data_t *fusion_data;
+
+/* distance travelled since the last fix, in 1/256 cm */
+static int32_t north = 0;
+static int32_t east = 0;
+static uint16_t anchored_at;
+static int16_t height = FUSION_DEFAULT_HEIGHT;
+static volatile uint8_t anchor_pending = 0;
+/* an offset saturated since the last fix */
+static uint8_t saturated = 0;
+
+static int16_t fusion_clamp(int16_t v, int16_t limit) {
+	if (v > limit) {
+		saturated = 1;
+		return limit;
+	} else if (v < -limit) {
+		saturated = 1;
+		return -limit;
+	}
+	return v;
+}
+
+static int16_t fusion_cm(int32_t v) {
+	/* scale to cm, saturating */
+	v >>= 8;
+	if (v > INT16_MAX || v < -INT16_MAX) {
+		saturated = 1;
+		return v > 0 ? INT16_MAX : -INT16_MAX;
+	}
+	return v;
+}
+
+void fusion_init(struct fusion_data_t *output) {
+	fusion_data = output;
+	anchored_at = tick_now() - FUSION_MAX_AGE;
+}
+
+/* a new valid fix has arrived, called from the parser */
+void fusion_anchor(void) {
+	anchor_pending = 1;
+}
+
+/* propagate the position by the optical motion, scaled by the height
+ * above ground (distance in cm, negative if unknown)
+ */
+void fusion_update(int16_t distance) {
+	uint16_t now = tick_now();
+	int16_t dx, dy;
+	optical_take(OPTICAL_TAKE_FUSION, &dx, &dy);
+
+	uint8_t flags = 0;
+	if (anchor_pending) {
+		/* motion up to now is part of the fix */
+		anchor_pending = 0;
+		north = 0;
+		east = 0;
+		anchored_at = now;
+		saturated = 0;
+		fusion_data->fixes++;
+	}
+
+	if (distance > 0) {
+		height = distance > FUSION_MAX_HEIGHT ? FUSION_MAX_HEIGHT : distance;
+		flags |= 1<<FUSION_FLAGS_HEIGHT;
+	}
+
+	uint16_t course = nmea_course();
+	if (course != NMEA_COURSE_UNKNOWN) {
+		flags |= 1<<FUSION_FLAGS_COURSE;
+		/* the sensor's y axis points forward, x to the right */
+		dx = fusion_clamp(dx, FUSION_MAX_COUNTS);
+		dy = fusion_clamp(dy, FUSION_MAX_COUNTS);
+		int16_t s = trig_sin(course);
+		int16_t c = trig_sin(course+90);
+		/* counts in units of 1/256 */
+		int32_t n = ((int32_t)dy*c - (int32_t)dx*s) >> 7;
+		int32_t e = ((int32_t)dy*s + (int32_t)dx*c) >> 7;
+		/* the ground distance per count grows with the height */
+		north += n * height / FUSION_FLOW_SCALE;
+		east += e * height / FUSION_FLOW_SCALE;
+	}
+
+	uint16_t age = now - anchored_at;
+	if (age >= FUSION_MAX_AGE) {
+		age = FUSION_MAX_AGE;
+		anchored_at = now - FUSION_MAX_AGE;
+	}
+	uint16_t lost = age / FUSION_CONFIDENCE_DECAY;
+	uint8_t confidence = lost > 255 ? 0 : 255 - lost;
+	if (!(flags & 1<<FUSION_FLAGS_HEIGHT)) {
+		confidence /= 2;
+	}
+	if (!(flags & 1<<FUSION_FLAGS_COURSE)) {
+		confidence = 0;
+	}
+
+	int16_t n_cm = fusion_cm(north);
+	int16_t e_cm = fusion_cm(east);
+	if (saturated) {
+		flags |= 1<<FUSION_FLAGS_SATURATED;
+	}
+	ATOMIC(ATOMIC_FORCEON) {
+		fusion_data->north = n_cm;
+		fusion_data->east = e_cm;
+		fusion_data->age = age;
+		fusion_data->confidence = confidence;
+		fusion_data->flags = flags;
+	}
+}
+#endif
@@ -0,0 +1,7 @@
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+void fusion_init(struct fusion_data_t *output);
+void fusion_anchor(void);
+void fusion_update(int16_t distance);
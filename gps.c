@@ -0,0 +1,589 @@
+#include "config.h"
+#if USE_GPS
+/* serial GPS receiver setup */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "hal.h"
+#include "nmea.h"
+#include "gps.h"
+#include "tick.h"
+#include "persist.h"
+#include "power.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+#if USE_GPS_FORWARD && USE_TELEMETRY
+	#error "USE_GPS_FORWARD and USE_TELEMETRY both need the UART transmitter"
+#endif
+
+#if USE_PERSIST && PERSIST_AIDING && !PARSE_GPS_TIME
+	#error "PERSIST_AIDING requires PARSE_GPS_TIME"
+#endif
+
+#if GPS_AUTOBAUD
+/* UBRR value for double speed mode */
+#define UBRR_2X(b) ((F_CPU + 4UL*(b)) / (8UL*(b)) - 1)
+/* can the baud rate be generated within 2% tolerance? */
+#define BAUD_OK(b) (UBRR_2X(b) <= 4095 && (b) <= GPS_AUTOBAUD_MAX && \
+	100UL*F_CPU <= 8UL*(UBRR_2X(b)+1)*(b)*102 && \
+	100UL*F_CPU >= 8UL*(UBRR_2X(b)+1)*(b)*98)
+
+struct gps_rate_t {
+	uint32_t baud;
+	uint16_t ubrr;
+};
+
+#define GPS_RATE(b) { b, UBRR_2X(b) },
+
+/* standard rates we can generate, in ascending order */
+static const struct gps_rate_t gps_rates[] PROGMEM = {
+#if BAUD_OK(4800)
+	GPS_RATE(4800)
+#endif
+#if BAUD_OK(9600)
+	GPS_RATE(9600)
+#endif
+#if BAUD_OK(19200)
+	GPS_RATE(19200)
+#endif
+#if BAUD_OK(38400)
+	GPS_RATE(38400)
+#endif
+#if BAUD_OK(57600)
+	GPS_RATE(57600)
+#endif
+#if BAUD_OK(115200)
+	GPS_RATE(115200)
+#endif
+};
+
+#define GPS_RATES (sizeof(gps_rates)/sizeof(gps_rates[0]))
+
+#if GPS_BAUD != 4800 && GPS_BAUD != 9600 && GPS_BAUD != 19200 && \
+    GPS_BAUD != 38400 && GPS_BAUD != 57600 && GPS_BAUD != 115200
+	#error "GPS_AUTOBAUD needs GPS_BAUD to be one of the standard rates"
+#endif
+#if !BAUD_OK(GPS_BAUD)
+	#error "GPS_BAUD cannot be generated accurately with this F_CPU"
+#endif
+#endif
+
+#if GPS_AUTOBAUD || GPS_NEGOTIATE || (USE_PERSIST && PERSIST_AIDING)
+static char gps_hex(uint8_t n) {
+	return n < 10 ? '0'+n : 'A'-10+n;
+}
+#endif
+
+#if GPS_AUTOBAUD || (USE_PERSIST && PERSIST_AIDING)
+/* checksum of the sentence being sent */
+static uint8_t send_cs;
+
+static void gps_putc(char c) {
+	/* wait for the transmit buffer to be empty */
+	while(!(UCSRA & (1<<UDRE)));
+	UDR = c;
+}
+
+static void gps_put(char c) {
+	send_cs ^= c;
+	gps_putc(c);
+}
+
+static void gps_sentence_end(void) {
+	gps_putc('*');
+	gps_putc(gps_hex(send_cs>>4));
+	gps_putc(gps_hex(send_cs & 0x0F));
+	gps_putc('\r');
+	gps_putc('\n');
+	/* wait for the transmission to complete */
+	UCSRA |= 1<<TXC;
+	while(!(UCSRA & (1<<TXC)));
+}
+#endif
+
+#if GPS_AUTOBAUD
+/* send $<body>*<checksum>\r\n to the receiver */
+static void gps_send_sentence(const char *body) {
+	gps_putc('$');
+	send_cs = 0;
+	while (*body) {
+		gps_put(*body++);
+	}
+	gps_sentence_end();
+}
+
+static void gps_set_rate(uint8_t i) {
+	uint16_t ubrr = pgm_read_word(&gps_rates[i].ubrr);
+	UCSRA = 1<<U2X;
+	UBRRH = ubrr>>8;
+	UBRRL = ubrr;
+}
+
+/* feed the receiver's output to the parser for about ms milliseconds;
+ * returns 1 as soon as a sentence with a valid checksum has been seen.
+ */
+static uint8_t gps_listen(uint16_t ms) {
+	uint8_t valid = nmea_valid_sentences();
+	/* discard whatever was received at the old rate */
+	while (UCSRA & (1<<RXC)) {
+		(void)UDR;
+	}
+	nmea_process_character('$');
+	for (uint16_t t=0; t<ms; t++) {
+		for (uint8_t i=0; i<100; i++) {
+			while (UCSRA & (1<<RXC)) {
+				nmea_process_character(UDR);
+				if (nmea_valid_sentences() != valid) {
+					return 1;
+				}
+			}
+			_delay_us(10);
+		}
+	}
+	return 0;
+}
+
+static uint8_t gps_find_rate(void) {
+#if USE_PERSIST
+	/* the receiver is probably still at the rate we left it, unless
+	 * that rate cannot be generated with this build
+	 */
+	uint8_t last = persist_last() ? persist_last()->baud : PERSIST_NONE;
+	for (uint8_t i=0; last != PERSIST_NONE && i<GPS_RATES; i++) {
+		if (pgm_read_dword(&gps_rates[i].baud) == (uint32_t)last * PERSIST_BAUD_UNIT) {
+			gps_set_rate(i);
+			if (gps_listen(GPS_AUTOBAUD_PROBE_TIME)) {
+				return i;
+			}
+		}
+	}
+#endif
+	/* try the configured rate first, then the others */
+	for (uint8_t i=0; i<GPS_RATES; i++) {
+		if (pgm_read_dword(&gps_rates[i].baud) == GPS_BAUD) {
+			gps_set_rate(i);
+			if (gps_listen(GPS_AUTOBAUD_PROBE_TIME)) {
+				return i;
+			}
+		}
+	}
+	for (uint8_t i=0; i<GPS_RATES; i++) {
+		if (pgm_read_dword(&gps_rates[i].baud) != GPS_BAUD) {
+			gps_set_rate(i);
+			if (gps_listen(GPS_AUTOBAUD_PROBE_TIME)) {
+				return i;
+			}
+		}
+	}
+	return GPS_RATES;
+}
+
+static uint8_t gps_upgrade_rate(uint8_t i) {
+	uint8_t best = GPS_RATES-1;
+	if (i == best) {
+		return i;
+	}
+	/* ask the receiver to switch to the fastest rate we can generate */
+	char cmd[16] = "PMTK251,";
+	ultoa(pgm_read_dword(&gps_rates[best].baud), &cmd[8], 10);
+	gps_send_sentence(cmd);
+	gps_set_rate(best);
+	if (!gps_listen(GPS_AUTOBAUD_PROBE_TIME)) {
+		/* the receiver did not follow, go back */
+		gps_set_rate(i);
+		return i;
+	}
+	return best;
+}
+#endif
+
+#if USE_PERSIST && PERSIST_AIDING
+static void gps_put_number(uint16_t n, uint8_t width) {
+	/* decimal, padded with zeroes to width digits */
+	char buf[6];
+	utoa(n, buf, 10);
+	for (uint8_t l=strlen(buf); l<width; l++) {
+		gps_put('0');
+	}
+	for (char *p=buf; *p; p++) {
+		gps_put(*p);
+	}
+}
+
+static void gps_put_coord(const struct coord *co, uint8_t positive) {
+	/* decimal degrees with 4 digits, from hundredths of minutes */
+	uint16_t hundredths = co->min*100 + (co->frac[0] & 0x0F)*10 + (co->frac[0]>>4);
+	if (!positive) {
+		gps_put('-');
+	}
+	gps_put_number(co->deg, 0);
+	gps_put('.');
+	gps_put_number(hundredths*5/3, 4);
+	gps_put(',');
+}
+
+/* hand the last fix to the receiver to shorten the time to the first fix;
+ * the time is off by however long we were switched off.
+ */
+static void gps_send_aiding(void) {
+	const struct persist_record_t *r = persist_last();
+	if (!r || !(r->flags & 1<<NMEA_RMC_FLAGS_STATUS_OK)) {
+		return;
+	}
+	gps_putc('$');
+	send_cs = 0;
+	for (PGM_P p=PSTR("PMTK741,"); pgm_read_byte(p); p++) {
+		gps_put(pgm_read_byte(p));
+	}
+	gps_put_coord(&r->lat, r->flags & 1<<NMEA_RMC_FLAGS_LAT_NORTH);
+	gps_put_coord(&r->lon, r->flags & 1<<NMEA_RMC_FLAGS_LON_EAST);
+	int16_t alt = r->alt.m;
+	if (alt < 0) {
+		gps_put('-');
+		alt = -alt;
+	}
+	gps_put_number(alt, 0);
+	gps_put(',');
+	gps_put_number(2000 + r->date.year, 0);
+	const uint8_t *t[] = {
+		&r->date.month, &r->date.day,
+		&r->clock.hour, &r->clock.minute, &r->clock.second,
+	};
+	for (uint8_t i=0; i<sizeof(t)/sizeof(t[0]); i++) {
+		gps_put(',');
+		gps_put_number(*t[i], 2);
+	}
+	gps_sentence_end();
+}
+#endif
+
+void gps_init(void) {
+	/* enable RX and TX pins, the receive interrupt is enabled later */
+	UCSRB = ( 1<<RXEN
+#if defined(GPS_INIT_STRING) || GPS_AUTOBAUD || GPS_NEGOTIATE || (USE_PERSIST && PERSIST_AIDING) || USE_GPS_FORWARD
+	| 1<<TXEN
+#endif
+	);
+
+	UCSRC = (0<<USBS)|(3<<UCSZ0);
+
+#if GPS_AUTOBAUD
+	uint8_t rate = gps_find_rate();
+	uint8_t found = rate != GPS_RATES;
+	if (!found) {
+		/* no receiver found, stay with the default */
+		for (rate=0; rate<GPS_RATES && pgm_read_dword(&gps_rates[rate].baud) != GPS_BAUD; rate++);
+		if (rate < GPS_RATES) {
+			gps_set_rate(rate);
+		}
+	}
+#elif defined(GPS_INIT_BAUD)
+	/* set initial baud rate for initialization */
+	#define BAUD GPS_INIT_BAUD
+	#include <util/setbaud.h>
+	UCSRA = (USE_2X<<U2X);
+	UBRRL = UBRRL_VALUE;
+	#undef BAUD
+#endif
+
+#ifdef GPS_INIT_STRING
+#ifdef GPS_INIT_DELAY
+	_delay_ms(GPS_INIT_DELAY);
+#endif
+	/* transmit configuration commands */
+	PGM_P init = PSTR(GPS_INIT_STRING);
+	const char *p = init;
+	char c;
+	while ((c = pgm_read_byte(p++)) != '\0') {
+		UDR = c;
+		/* wait for transmission to complete */
+		while(!(UCSRA & (1<<UDRE)));
+#ifdef GPS_INIT_LINEFEED_DELAY
+		if (c == '\n') {
+			_delay_ms(GPS_INIT_LINEFEED_DELAY);
+		}
+#endif
+	}
+#endif
+
+#if GPS_AUTOBAUD
+	/* without a receiver, neither try to switch it nor forget the
+	 * rate it was last seen at
+	 */
+	if (found) {
+		rate = gps_upgrade_rate(rate);
+#if USE_PERSIST
+		persist_set_baud(pgm_read_dword(&gps_rates[rate].baud));
+#endif
+	}
+#else
+	/* now set final baud rate */
+	#define BAUD GPS_BAUD
+	#include <util/setbaud.h>
+	UCSRA = (USE_2X<<U2X);
+	UBRRL = UBRRL_VALUE;
+#endif
+
+#if USE_PERSIST && PERSIST_AIDING
+	gps_send_aiding();
+#endif
+
+	/* hand the received data to the interrupt handler */
+	UCSRB |= 1<<RXCIE;
+}
+
+#if GPS_NEGOTIATE
+/* progress of the command being sent */
+static enum {
+	TX_START,
+	TX_BODY,
+	TX_CS_HIGH,
+	TX_CS_LOW,
+	TX_CR,
+	TX_LF,
+	TX_DONE,
+} tx_stage = TX_DONE;
+
+#endif
+
+#if USE_GPS_FORWARD
+/* data from the master on its way to the receiver */
+#define FWD_BUF_SIZE HAL_TX_BUF_SIZE
+static volatile uint8_t fwd_buf[FWD_BUF_SIZE];
+static volatile uint8_t fwd_buf_r = 0;
+static volatile uint8_t fwd_buf_w = 0;
+
+static struct gps_forward_t *forward;
+
+static uint8_t fwd_free(void) {
+	/* one byte stays free to tell a full buffer from an empty one */
+	uint8_t r = fwd_buf_r;
+	if (r <= fwd_buf_w) {
+		r += FWD_BUF_SIZE;
+	}
+	return r - fwd_buf_w - 1;
+}
+
+void gps_forward_init(struct gps_forward_t *output) {
+	forward = output;
+	forward->free = fwd_free();
+	forward->sent = 0;
+}
+
+/* called from the TWI interrupt, before a byte is acknowledged */
+uint8_t gps_forward_free(void) {
+	return fwd_free();
+}
+
+/* called from the TWI interrupt for every byte written to the FIFO */
+void gps_forward_put(uint8_t c) {
+	if (!fwd_free()) {
+		return;
+	}
+	fwd_buf[fwd_buf_w] = c;
+	fwd_buf_w = fwd_buf_w + 1 < FWD_BUF_SIZE ? fwd_buf_w + 1 : 0;
+	forward->free = fwd_free();
+#if GPS_NEGOTIATE
+	/* a command being sent is finished first */
+	if (tx_stage != TX_DONE) {
+		return;
+	}
+#endif
+	UCSRB |= 1<<UDRIE;
+}
+
+ISR(USART_UDRE_vect) {
+	POWER_WAKE(POWER_WAKE_UART);
+	if (fwd_buf_r == fwd_buf_w) {
+		UCSRB &= ~(1<<UDRIE);
+		return;
+	}
+	UDR = fwd_buf[fwd_buf_r];
+	fwd_buf_r = fwd_buf_r + 1 < FWD_BUF_SIZE ? fwd_buf_r + 1 : 0;
+	forward->free = fwd_free();
+	forward->sent++;
+}
+#endif
+
+#if GPS_NEGOTIATE
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+/* enable RMC and/or GGA only, once per fix */
+static const char cmd_output[] PROGMEM = "PMTK314,0,"
+	STR(PARSE_GPS_NMEA_RMC) ",0," STR(PARSE_GPS_NMEA_GGA)
+	",0,0,0,0,0,0,0,0,0,0,0,0,0,0,0";
+#if GPS_UPDATE_INTERVAL
+static const char cmd_interval[] PROGMEM = "PMTK220," STR(GPS_UPDATE_INTERVAL);
+static const char cmd_interval_old[] PROGMEM = "PMTK300," STR(GPS_UPDATE_INTERVAL) ",0,0,0,0";
+#endif
+
+struct gps_command_t {
+	/* sentence body in program memory */
+	PGM_P body;
+	/* command number acknowledged by $PMTK001 */
+	uint16_t id;
+	/* only send this command if the preceding one failed */
+	uint8_t fallback;
+};
+
+static const struct gps_command_t gps_commands[] PROGMEM = {
+	{ cmd_output, 314, 0 },
+#if GPS_UPDATE_INTERVAL
+	{ cmd_interval, 220, 0 },
+	{ cmd_interval_old, 300, 1 },
+#endif
+};
+
+#define GPS_COMMANDS (sizeof(gps_commands)/sizeof(gps_commands[0]))
+
+static PGM_P tx_pos;
+static uint8_t tx_cs;
+
+static struct gps_session_t *session;
+static uint8_t retries;
+/* time the last command was sent or the negotiation finished */
+static uint16_t sent_at;
+/* number of unexpected sentences seen so far */
+static uint8_t others;
+
+static uint8_t gps_send_step(void) {
+	/* hand as many characters to the UART as it takes without waiting;
+	 * returns 1 once the sentence is sent completely
+	 */
+	while (tx_stage != TX_DONE && (UCSRA & (1<<UDRE))) {
+		char c;
+		switch (tx_stage) {
+			case TX_START:
+#if USE_GPS_FORWARD
+				if (UCSRB & (1<<UDRIE)) {
+					/* forwarded data goes first */
+					return 0;
+				}
+#endif
+				c = '$';
+				break;
+			case TX_BODY:
+				c = pgm_read_byte(tx_pos++);
+				if (c != '\0') {
+					tx_cs ^= c;
+					UDR = c;
+					continue;
+				}
+				c = '*';
+				break;
+			case TX_CS_HIGH:
+				c = gps_hex(tx_cs>>4);
+				break;
+			case TX_CS_LOW:
+				c = gps_hex(tx_cs & 0x0F);
+				break;
+			case TX_CR:
+				c = '\r';
+				break;
+			default:
+				c = '\n';
+				break;
+		}
+		UDR = c;
+		tx_stage++;
+	}
+#if USE_GPS_FORWARD
+	if (tx_stage == TX_DONE) {
+		/* hand the transmitter back to the forwarded data */
+		ATOMIC(ATOMIC_FORCEON) {
+			if (fwd_buf_r != fwd_buf_w) {
+				UCSRB |= 1<<UDRIE;
+			}
+		}
+	}
+#endif
+	return tx_stage == TX_DONE;
+}
+
+static void gps_session_send(void) {
+	tx_pos = (PGM_P)pgm_read_word(&gps_commands[session->state].body);
+	tx_cs = 0;
+	tx_stage = TX_START;
+}
+
+static void gps_session_next(uint8_t failed) {
+	if (failed) {
+		session->rejected |= 1<<session->state;
+	}
+	session->state++;
+	if (!failed && session->state < GPS_COMMANDS &&
+	    pgm_read_byte(&gps_commands[session->state].fallback)) {
+		/* no need for the fallback */
+		session->state++;
+	}
+	retries = 0;
+	if (session->state < GPS_COMMANDS) {
+		gps_session_send();
+	} else {
+		session->state = GPS_SESSION_DONE;
+		sent_at = tick_now();
+	}
+}
+
+static void gps_session_restart(void) {
+	session->state = 0;
+	session->rejected = 0;
+	retries = 0;
+	gps_session_send();
+}
+
+void gps_session_init(struct gps_session_t *output) {
+	session = output;
+	gps_session_restart();
+}
+
+void gps_session_task(void) {
+	if (session->state == GPS_SESSION_DONE) {
+		if ((uint16_t)(tick_now() - sent_at) < GPS_ACK_TIMEOUT ||
+		    session->rejected & 1<<0) {
+			/* sentences still in flight when the filter was set, or
+			 * a receiver that does not filter: nothing to watch
+			 */
+			others = nmea_other_sentences();
+		} else if (nmea_other_sentences() != others) {
+			/* the receiver was reset and fell back to its defaults */
+			session->restarts++;
+			gps_session_restart();
+		}
+		return;
+	}
+	if (tx_stage != TX_DONE) {
+		if (gps_send_step()) {
+			sent_at = tick_now();
+		}
+		return;
+	}
+	uint8_t flag = nmea_take_ack(pgm_read_word(&gps_commands[session->state].id));
+	if (flag == NMEA_ACK_SUCCESS) {
+		gps_session_next(0);
+	} else if (flag < 2) {
+		/* invalid or unsupported, no point in trying again */
+		gps_session_next(1);
+	} else if (flag != NMEA_ACK_NONE ||
+		   (uint16_t)(tick_now() - sent_at) >= GPS_ACK_TIMEOUT) {
+		/* failed or no answer */
+		if (++retries < GPS_NEGOTIATE_RETRIES) {
+			gps_session_send();
+		} else {
+			gps_session_next(1);
+		}
+	}
+}
+#endif
+#endif
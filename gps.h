@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+#define GPS_SESSION_DONE 0xFF
+
+void gps_init(void);
+void gps_session_init(struct gps_session_t *output);
+void gps_session_task(void);
+#if USE_GPS_FORWARD
+void gps_forward_init(struct gps_forward_t *output);
+uint8_t gps_forward_free(void);
+void gps_forward_put(uint8_t c);
+#endif
@@ -0,0 +1,175 @@
+/* hardware abstraction: peripherals and pins of the supported parts */
+#include <avr/io.h>
+
+#if defined( __AVR_ATtiny2313__ ) | defined( __AVR_ATtiny2313A__ ) | \
+    defined( __AVR_ATtiny4313__ )
+/* TWI slave on the USI, see usiTwiSlave.c */
+#  define HAL_TWI_USI         1
+#  define HAL_SPI             0
+/* bytes buffered between the UART interrupt and the parser */
+#  define HAL_RX_BUF_SIZE     4
+/* bytes forwarded to the receiver, the master retries whatever does not fit */
+#  define HAL_TX_BUF_SIZE     16
+
+#  define TICK_TIMSK          TIMSK
+#  define TICK_TIFR           TIFR
+#  define CAPTURE_TIMSK       TIMSK
+#  define CAPTURE_TIFR        TIFR
+/* INT1 sense control and mask */
+#  define EXT_INT_CTRL        MCUCR
+#  define EXT_INT_MASK        GIMSK
+
+#  define SONAR_TRIGGER_PORT  PORTD
+#  define SONAR_TRIGGER_DDR   DDRD
+#  define SONAR_TRIGGER_BIT   PD2
+
+#  define LED_PORT            PORTD
+#  define LED_DDR             DDRD
+#  define LED_BIT             PD5
+
+#  define ALARM_PORT          PORTD
+#  define ALARM_DDR           DDRD
+#  define ALARM_BIT           PD4
+
+/* TWI address straps, consecutive pins from the first one */
+#  define ADDR_STRAP_PIN      PINB
+#  define ADDR_STRAP_PORT     PORTB
+#  define ADDR_STRAP_DDR      DDRB
+#  define ADDR_STRAP_BIT      PB1
+
+#  define OPTICAL_SCLK_PORT   PORTA
+#  define OPTICAL_SDIO_PORT   PORTA
+#  define OPTICAL_CSEL_PORT   PORTB
+#  define OPTICAL_SCLK_DDR    DDRA
+#  define OPTICAL_SDIO_DDR    DDRA
+#  define OPTICAL_CSEL_DDR    DDRB
+#  define OPTICAL_SCLK_PIN    PINA
+#  define OPTICAL_SDIO_PIN    PINA
+#  define OPTICAL_CSEL_PIN    PINB
+#  define OPTICAL_SCLK_BIT    PA0
+#  define OPTICAL_SDIO_BIT    PA1
+#  define OPTICAL_CSEL_BIT    PB6
+#  define OPTICAL_MOTION_PIN  PIND
+#  define OPTICAL_MOTION_PORT PORTD
+#  define OPTICAL_MOTION_BIT  PD3
+
+#  define PPS_PIN             PINB
+#  define PPS_DDR             DDRB
+#  define PPS_BIT             PB0
+#  define PPS_PCMSK           PCMSK
+#  define PPS_PCICR           GIMSK
+#  if defined( __AVR_ATtiny4313__ )
+/* three pin change interrupts, port B comes first */
+#    define PPS_PCIE          PCIE0
+#    define PPS_VECTOR        PCINT_B_vect
+#  else
+#    define PPS_PCIE          PCIE
+#    define PPS_VECTOR        PCINT_vect
+#  endif
+#endif
+
+#if defined( __AVR_ATmega88__ ) | defined( __AVR_ATmega88P__ ) | \
+    defined( __AVR_ATmega168__ ) | defined( __AVR_ATmega168P__ ) | \
+    defined( __AVR_ATmega328__ ) | defined( __AVR_ATmega328P__ )
+/* TWI slave on the TWI peripheral, see twiSlave.c */
+#  define HAL_TWI_USI         0
+#  define HAL_SPI             1
+#  define HAL_RX_BUF_SIZE     64
+/* at least one telemetry frame */
+#  define HAL_TX_BUF_SIZE     128
+
+/* USART0 is the UART of the tiny parts under different names */
+#  define UCSRA               UCSR0A
+#  define UCSRB               UCSR0B
+#  define UCSRC               UCSR0C
+#  define UBRRH               UBRR0H
+#  define UBRRL               UBRR0L
+#  define UDR                 UDR0
+#  define RXC                 RXC0
+#  define TXC                 TXC0
+#  define UDRE                UDRE0
+#  define U2X                 U2X0
+#  define RXCIE               RXCIE0
+#  define TXCIE               TXCIE0
+#  define UDRIE               UDRIE0
+#  define RXEN                RXEN0
+#  define TXEN                TXEN0
+#  define USBS                USBS0
+#  define UCSZ0               UCSZ00
+
+#  define TICK_TIMSK          TIMSK0
+#  define TICK_TIFR           TIFR0
+#  define CAPTURE_TIMSK       TIMSK1
+#  define CAPTURE_TIFR        TIFR1
+#  define EXT_INT_CTRL        EICRA
+#  define EXT_INT_MASK        EIMSK
+
+#  define SONAR_TRIGGER_PORT  PORTD
+#  define SONAR_TRIGGER_DDR   DDRD
+#  define SONAR_TRIGGER_BIT   PD2
+
+#  define LED_PORT            PORTD
+#  define LED_DDR             DDRD
+#  define LED_BIT             PD5
+
+#  define ALARM_PORT          PORTD
+#  define ALARM_DDR           DDRD
+#  define ALARM_BIT           PD4
+
+/* the TWI lines, sampled by the bus watchdog */
+#  define TWI_PIN             PINC
+#  define TWI_SDA_BIT         PC4
+#  define TWI_SCL_BIT         PC5
+
+/* TWI address straps, consecutive pins from the first one */
+#  define ADDR_STRAP_PIN      PINC
+#  define ADDR_STRAP_PORT     PORTC
+#  define ADDR_STRAP_DDR      DDRC
+#  define ADDR_STRAP_BIT      PC0
+
+/* the hardware SPI pins; SDIO is MOSI, connected to MISO by a 1k resistor */
+#  define OPTICAL_SCLK_PORT   PORTB
+#  define OPTICAL_SDIO_PORT   PORTB
+#  define OPTICAL_CSEL_PORT   PORTB
+#  define OPTICAL_SCLK_DDR    DDRB
+#  define OPTICAL_SDIO_DDR    DDRB
+#  define OPTICAL_CSEL_DDR    DDRB
+#  define OPTICAL_SCLK_PIN    PINB
+#  define OPTICAL_SDIO_PIN    PINB
+#  define OPTICAL_CSEL_PIN    PINB
+#  define OPTICAL_SCLK_BIT    PB5
+#  define OPTICAL_SDIO_BIT    PB3
+#  define OPTICAL_CSEL_BIT    PB2
+#  define OPTICAL_MOTION_PIN  PIND
+#  define OPTICAL_MOTION_PORT PORTD
+#  define OPTICAL_MOTION_BIT  PD3
+
+/* PB0 is the input capture pin here */
+#  define PPS_PIN             PINB
+#  define PPS_DDR             DDRB
+#  define PPS_BIT             PB1
+#  define PPS_PCMSK           PCMSK0
+#  define PPS_PCICR           PCICR
+#  define PPS_PCIE            PCIE0
+#  define PPS_VECTOR          PCINT0_vect
+#endif
+
+#ifndef HAL_TWI_USI
+#  error "unsupported MCU"
+#endif
+
+/* the bus slave backend */
+#if HAL_TWI_USI
+#  include "usiTwiSlave.h"
+#  define twiSlaveInit              usiTwiSlaveInit
+#  define twiSlaveSetTrap           usiTwiSlaveSetTrap
+#  define twiSlaveSetReceiver       usiTwiSlaveSetReceiver
+#  define twiSlaveSetStream         usiTwiSlaveSetStream
+#  define twiSlaveSetFlowControl    usiTwiSlaveSetFlowControl
+#  define twiSlaveSetTransmitWindow usiTwiSetTransmitWindow
+#  define twiSlaveWatchdog          usiTwiSlaveWatchdog
+#  define twiSlaveSetAddress        usiTwiSlaveSetAddress
+#  define twiSlaveSetGeneralCall    usiTwiSlaveSetGeneralCall
+#else
+#  include "twiSlave.h"
+#endif
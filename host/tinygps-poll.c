@@ -0,0 +1,100 @@
+/* poll a tiny-gps controller and report the fixes and the timing of the reads
+ *
+ *   tinygps-poll [-b bus] [-a address] [-r rate] [-t seconds] [-e]
+ *
+ * -e polls an in-process emulator of the register window instead of a bus
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinygps.h"
+
+static void sample(const struct tinygps_nav_data *regs, unsigned long banks,
+		const struct timespec *t, void *arg)
+{
+	struct tinygps_nav_data *last = arg;
+	(void)banks;
+	(void)t;
+	*last = *regs;
+}
+
+static void emulate(struct tinygps *dev)
+{
+	struct tinygps_nmea_data gps;
+	memset(&gps, 0, sizeof(gps));
+	gps.flags = 0x07;
+	gps.clock.hour = 12;
+	gps.lat.deg = 51;
+	gps.lat.min = 28;
+	gps.lon.deg = 7;
+	gps.lon.min = 12;
+	gps.quality = 1;
+	gps.sats = 8;
+	tinygps_emulator_set(dev, offsetof(struct tinygps_nav_data, gps),
+			&gps, sizeof(gps));
+}
+
+int main(int argc, char **argv)
+{
+	const char *bus = "/dev/i2c-1";
+	unsigned address = 0x11;
+	unsigned rate = 50;
+	unsigned seconds = 5;
+	int emulator = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:a:r:t:e")) != -1) {
+		switch (c) {
+		case 'b': bus = optarg; break;
+		case 'a': address = strtoul(optarg, NULL, 0); break;
+		case 'r': rate = strtoul(optarg, NULL, 0); break;
+		case 't': seconds = strtoul(optarg, NULL, 0); break;
+		case 'e': emulator = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-b bus] [-a address] [-r rate] "
+					"[-t seconds] [-e]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	struct tinygps *dev = emulator ? tinygps_open_emulator() :
+		tinygps_open(bus, address);
+	if (!dev) {
+		fprintf(stderr, "%s: %s\n", emulator ? "emulator" : bus,
+				errno == EPROTO ? "register layout differs, "
+				"regenerate tiny-gps-regs.h" : strerror(errno));
+		return 1;
+	}
+	if (emulator) {
+		emulate(dev);
+	}
+
+	struct tinygps_nav_data last;
+	memset(&last, 0, sizeof(last));
+	unsigned long banks = TINYGPS_BANK(GPS) | TINYGPS_BANK(SONAR);
+	if (tinygps_poll_start(dev, banks, rate, sample, &last) < 0) {
+		perror("poll");
+		tinygps_close(dev);
+		return 1;
+	}
+	sleep(seconds);
+	tinygps_poll_stop(dev);
+
+	struct tinygps_stats s;
+	tinygps_poll_stats(dev, &s, 0);
+	printf("fix %02u:%02u:%02u lat %u %u lon %u %u sats %u distance %d cm\n",
+			last.gps.clock.hour, last.gps.clock.minute,
+			last.gps.clock.second, last.gps.lat.deg, last.gps.lat.min,
+			last.gps.lon.deg, last.gps.lon.min, last.gps.sats,
+			last.sonar.distance);
+	printf("%lu samples, %lu errors, %lu overruns\n",
+			s.samples, s.errors, s.overruns);
+	printf("jitter min/avg/max %ld/%ld/%ld us, read %ld/%ld/%ld us\n",
+			s.jitter_min / 1000, s.jitter_avg / 1000, s.jitter_max / 1000,
+			s.xfer_min / 1000, s.xfer_avg / 1000, s.xfer_max / 1000);
+	tinygps_close(dev);
+	return 0;
+}
@@ -0,0 +1,382 @@
+/* publish the fixes of a tiny-gps controller in shared memory: the NTP
+ * SHM refclock segment (chrony, ntpd) and, built with HAVE_LIBGPS, the
+ * export segment of gpsd read by gps_open(GPSD_SHARED_MEMORY, ...)
+ *
+ *   tinygps-shmd [-b bus] [-a address] [-r rate] [-u unit] [-n] [-e]
+ *
+ * -u selects the NTP SHM unit, -n disables the NTP segment and
+ * -e polls an in-process emulator of the register window instead of a bus
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "tinygps.h"
+
+#ifdef HAVE_LIBGPS
+#include <gps.h>
+#if GPSD_API_MAJOR_VERSION < 9
+#error "gpsd 3.20 or later is required"
+#endif
+#ifndef GPSD_SHM_KEY
+#define GPSD_SHM_KEY 0x47505344
+#endif
+#endif
+
+/* segment of the NTP SHM refclock driver */
+#define NTP_SHM_KEY 0x4e545030
+
+struct ntp_shm {
+	int mode;
+	volatile int count;
+	time_t clock_sec;
+	int clock_usec;
+	time_t receive_sec;
+	int receive_usec;
+	int leap;
+	int precision;
+	int nsamples;
+	volatile int valid;
+	unsigned clock_nsec;
+	unsigned receive_nsec;
+	int dummy[8];
+};
+
+/* precision of the time stamps as a power of 2 in seconds: PPS pulses are
+ * timed by the 1 ms system tick, sentences arrive up to a second late
+ */
+#define PRECISION_PPS -10
+#define PRECISION_SENTENCE -1
+
+#ifdef HAVE_LIBGPS
+/* layout of gpsd's export segment, see gpsd.h */
+struct gpsd_shm {
+	volatile int bookend1;
+	struct gps_data_t gpsdata;
+	volatile int bookend2;
+};
+#endif
+
+struct state {
+	struct ntp_shm *ntp;
+#ifdef HAVE_LIBGPS
+	struct gpsd_shm *gpsd;
+	int tick;
+#endif
+	struct tinygps_nmea_data last;
+	time_t last_time;
+	uint8_t last_pulses;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static void *attach(key_t key, size_t size, int mode)
+{
+	int id = shmget(key, size, IPC_CREAT | mode);
+	if (id < 0) {
+		return NULL;
+	}
+	void *p = shmat(id, NULL, 0);
+	return p == (void *)-1 ? NULL : p;
+}
+
+static void ntp_publish(struct ntp_shm *shm, const struct timespec *clock,
+		const struct timespec *receive, int precision)
+{
+	shm->mode = 1;
+	shm->valid = 0;
+	shm->count++;
+	__sync_synchronize();
+	shm->clock_sec = clock->tv_sec;
+	shm->clock_usec = clock->tv_nsec / 1000;
+	shm->clock_nsec = clock->tv_nsec;
+	shm->receive_sec = receive->tv_sec;
+	shm->receive_usec = receive->tv_nsec / 1000;
+	shm->receive_nsec = receive->tv_nsec;
+	shm->leap = 0;
+	shm->precision = precision;
+	shm->nsamples = 3;
+	__sync_synchronize();
+	shm->count++;
+	shm->valid = 1;
+}
+
+/* UTC of the sentence, 0 if the receiver has no valid time yet */
+static time_t fix_time(const struct tinygps_nmea_data *gps, int hour,
+		int minute, int second)
+{
+	struct tm tm;
+	if (!gps->date.day || !gps->date.month) {
+		return 0;
+	}
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = 100 + gps->date.year;
+	tm.tm_mon = gps->date.month - 1;
+	tm.tm_mday = gps->date.day;
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = second;
+	return timegm(&tm);
+}
+
+/* translate a monotonic time stamp of the poller to the system clock */
+static struct timespec realtime(const struct timespec *t)
+{
+	struct timespec mono, real;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	long long ns = (long long)(real.tv_sec - mono.tv_sec + t->tv_sec) * 1000000000LL +
+		real.tv_nsec - mono.tv_nsec + t->tv_nsec;
+	return (struct timespec){ ns / 1000000000LL, ns % 1000000000LL };
+}
+
+static void publish_time(struct state *s, const struct tinygps_nav_data *regs,
+		const struct timespec *t)
+{
+	const struct tinygps_nmea_data *gps = &regs->gps;
+	struct timespec receive = realtime(t);
+#if TINYGPS_HAS_PPS
+	const struct tinygps_pps_data *pps = &regs->pps;
+	if (pps->flags & 1 << TINYGPS_PPS_FLAGS_VALID) {
+		if (pps->pulses == s->last_pulses) {
+			return;
+		}
+		s->last_pulses = pps->pulses;
+		time_t sec = fix_time(gps, pps->clock.hour, pps->clock.minute,
+				pps->clock.second);
+		if (!sec) {
+			return;
+		}
+		/* the date may already have moved on past midnight */
+		if (sec > receive.tv_sec + 43200) {
+			sec -= 86400;
+		}
+		/* the sub-ms offset counts TINYGPS_TICK_PRESCALER CPU cycles */
+		long long elapsed = pps->offset_ms * 1000000LL +
+			pps->offset_sub * TINYGPS_TICK_PRESCALER * 1000000000LL /
+			TINYGPS_F_CPU;
+		long long ns = receive.tv_sec * 1000000000LL + receive.tv_nsec - elapsed;
+		struct timespec clock = { sec, 0 };
+		receive = (struct timespec){ ns / 1000000000LL, ns % 1000000000LL };
+		ntp_publish(s->ntp, &clock, &receive, PRECISION_PPS);
+		return;
+	}
+#endif
+	time_t sec = fix_time(gps, gps->clock.hour, gps->clock.minute,
+			gps->clock.second);
+	if (!sec || sec == s->last_time) {
+		return;
+	}
+	s->last_time = sec;
+	struct timespec clock = { sec, 0 };
+	ntp_publish(s->ntp, &clock, &receive, PRECISION_SENTENCE);
+}
+
+#ifdef HAVE_LIBGPS
+/* GGA fix quality to gpsd's fix status */
+static int fix_status(uint8_t quality)
+{
+	switch (quality) {
+	case 0: return STATUS_NO_FIX;
+#if GPSD_API_MAJOR_VERSION >= 12
+	case 2: return STATUS_DGPS;
+	case 4: return STATUS_RTK_FIX;
+	case 5: return STATUS_RTK_FLT;
+	case 6: return STATUS_DR;
+	default: return STATUS_GPS;
+#else
+	case 2: return STATUS_DGPS_FIX;
+	default: return STATUS_FIX;
+#endif
+	}
+}
+
+static void gpsd_publish(struct state *s, const struct tinygps_nmea_data *gps,
+		const struct timespec *t)
+{
+	struct gps_data_t data;
+	int valid = gps->flags & 1 << TINYGPS_NMEA_RMC_FLAGS_STATUS_OK;
+	time_t sec = fix_time(gps, gps->clock.hour, gps->clock.minute,
+			gps->clock.second);
+
+	memset(&data, 0, sizeof(data));
+	gps_clear_fix(&data.fix);
+	data.online = realtime(t);
+	data.set = ONLINE_SET | MODE_SET | STATUS_SET;
+	data.satellites_used = gps->sats;
+	if (!valid) {
+		data.fix.mode = MODE_NO_FIX;
+	} else {
+		/* a height needs a fourth satellite */
+		data.fix.mode = gps->sats >= 4 ? MODE_3D : MODE_2D;
+		data.fix.latitude = tinygps_latitude(gps);
+		data.fix.longitude = tinygps_longitude(gps);
+		data.set |= LATLON_SET;
+		if (data.fix.mode == MODE_3D) {
+			data.fix.altMSL = tinygps_altitude(gps);
+			data.set |= ALTITUDE_SET;
+		}
+	}
+#if GPSD_API_MAJOR_VERSION >= 12
+	data.fix.status = valid ? fix_status(gps->quality) : STATUS_NO_FIX;
+#else
+	data.status = valid ? fix_status(gps->quality) : STATUS_NO_FIX;
+#endif
+	if (sec) {
+		data.fix.time.tv_sec = sec;
+		data.set |= TIME_SET;
+	}
+
+	/* readers retry until both bookends match */
+	s->gpsd->bookend2 = ++s->tick;
+	__sync_synchronize();
+	memcpy((void *)&s->gpsd->gpsdata, &data, sizeof(data));
+	__sync_synchronize();
+	s->gpsd->bookend1 = s->tick;
+}
+#endif
+
+static void sample(const struct tinygps_nav_data *regs, unsigned long banks,
+		const struct timespec *t, void *arg)
+{
+	struct state *s = arg;
+	(void)banks;
+	if (s->ntp && regs->gps.flags & 1 << TINYGPS_NMEA_RMC_FLAGS_STATUS_OK) {
+		publish_time(s, regs, t);
+	}
+	if (!memcmp(&regs->gps, &s->last, sizeof(s->last))) {
+		return;
+	}
+	s->last = regs->gps;
+#ifdef HAVE_LIBGPS
+	if (s->gpsd) {
+		gpsd_publish(s, &regs->gps, t);
+	}
+#endif
+}
+
+/* a receiver with a fix at the current time */
+static void emulate(struct tinygps *dev)
+{
+	struct tinygps_nmea_data gps;
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+	memset(&gps, 0, sizeof(gps));
+	gps.flags = 1 << TINYGPS_NMEA_RMC_FLAGS_STATUS_OK |
+		1 << TINYGPS_NMEA_RMC_FLAGS_LAT_NORTH |
+		1 << TINYGPS_NMEA_RMC_FLAGS_LON_EAST;
+	gps.date.day = tm.tm_mday;
+	gps.date.month = tm.tm_mon + 1;
+	gps.date.year = tm.tm_year % 100;
+	gps.clock.hour = tm.tm_hour;
+	gps.clock.minute = tm.tm_min;
+	gps.clock.second = tm.tm_sec;
+	gps.lat.deg = 51;
+	gps.lat.min = 28;
+	gps.lat.frac[0] = 0x21;
+	gps.lon.deg = 7;
+	gps.lon.min = 12;
+	gps.lon.frac[0] = 0x43;
+	gps.alt.m = 104;
+	gps.quality = 1;
+	gps.sats = 8;
+	tinygps_emulator_set(dev, offsetof(struct tinygps_nav_data, gps),
+			&gps, sizeof(gps));
+}
+
+int main(int argc, char **argv)
+{
+	const char *bus = "/dev/i2c-1";
+	unsigned address = 0x11;
+	unsigned rate = 20;
+	int unit = 0;
+	int emulator = 0;
+	struct state s;
+	int c;
+
+	memset(&s, 0, sizeof(s));
+	while ((c = getopt(argc, argv, "b:a:r:u:ne")) != -1) {
+		switch (c) {
+		case 'b': bus = optarg; break;
+		case 'a': address = strtoul(optarg, NULL, 0); break;
+		case 'r': rate = strtoul(optarg, NULL, 0); break;
+		case 'u': unit = atoi(optarg); break;
+		case 'n': unit = -1; break;
+		case 'e': emulator = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-b bus] [-a address] [-r rate] "
+					"[-u unit] [-n] [-e]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (unit >= 0) {
+		/* units 0 and 1 are reserved to root by convention */
+		s.ntp = attach(NTP_SHM_KEY + unit, sizeof(*s.ntp),
+				unit < 2 ? 0600 : 0666);
+		if (!s.ntp) {
+			perror("NTP SHM");
+			return 1;
+		}
+	}
+#ifdef HAVE_LIBGPS
+	s.gpsd = attach(GPSD_SHM_KEY, sizeof(*s.gpsd), 0666);
+	if (!s.gpsd) {
+		perror("gpsd SHM");
+		return 1;
+	}
+#endif
+
+	struct tinygps *dev = emulator ? tinygps_open_emulator() :
+		tinygps_open(bus, address);
+	if (!dev) {
+		fprintf(stderr, "%s: %s\n", emulator ? "emulator" : bus,
+				errno == EPROTO ? "register layout differs, "
+				"regenerate tiny-gps-regs.h" : strerror(errno));
+		return 1;
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	unsigned long banks = TINYGPS_BANK(GPS);
+#if TINYGPS_HAS_PPS
+	banks |= TINYGPS_BANK(PPS);
+#endif
+	if (emulator) {
+		emulate(dev);
+	}
+	if (tinygps_poll_start(dev, banks, rate, sample, &s) < 0) {
+		perror("poll");
+		tinygps_close(dev);
+		return 1;
+	}
+	while (running) {
+		sleep(1);
+		if (emulator) {
+			emulate(dev);
+		}
+	}
+	tinygps_poll_stop(dev);
+
+	struct tinygps_stats st;
+	tinygps_poll_stats(dev, &st, 0);
+	fprintf(stderr, "%lu samples, %lu errors, %lu overruns, "
+			"jitter max %ld us\n", st.samples, st.errors, st.overruns,
+			st.jitter_max / 1000);
+	tinygps_close(dev);
+	return 0;
+}
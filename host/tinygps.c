@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "tinygps.h"
+
+/* a contiguous part of the register window read in one go */
+struct range {
+	uint8_t offset;
+	uint8_t len;
+};
+
+struct bank {
+	uint8_t offset;
+	uint8_t size;
+	uint8_t trap;
+};
+
+static const struct bank banks[TINYGPS_BANK_COUNT] = {
+#define TINYGPS_BANK_ENTRY(id, member, trap) \
+	{ offsetof(struct tinygps_nav_data, member), \
+	  sizeof(((struct tinygps_nav_data *)0)->member), trap },
+	TINYGPS_BANKS(TINYGPS_BANK_ENTRY)
+#undef TINYGPS_BANK_ENTRY
+};
+
+/* SMBus I2C block transfers are limited to 32 bytes */
+#define SMBUS_BLOCK 32
+
+enum backend {
+	BACKEND_I2C,
+	BACKEND_SMBUS,
+	BACKEND_EMULATOR,
+};
+
+struct tinygps {
+	enum backend backend;
+	int fd;
+	uint8_t address;
+	/* the adapter only takes one write/read pair per I2C_RDWR */
+	int single_pair;
+
+	uint8_t image[TINYGPS_SIZE];
+	pthread_mutex_t image_lock;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int polling;
+	unsigned long poll_banks;
+	long period;
+	tinygps_sample_fn fn;
+	void *arg;
+	struct tinygps_stats stats;
+	long long jitter_sum;
+	long long xfer_sum;
+};
+
+static unsigned plan(unsigned long mask, struct range *ranges)
+{
+	unsigned n = 0;
+	int blocked = 0;
+	for (unsigned i = 0; i < TINYGPS_BANK_COUNT; i++) {
+		const struct bank *b = &banks[i];
+		if (!(mask & 1UL << i)) {
+			blocked |= b->trap;
+			continue;
+		}
+		if (n) {
+			struct range *last = &ranges[n-1];
+			unsigned end = last->offset + last->len;
+			if (!blocked && b->offset - end <= TINYGPS_MERGE_GAP) {
+				last->len = b->offset + b->size - last->offset;
+				blocked = 0;
+				continue;
+			}
+		}
+		ranges[n].offset = b->offset;
+		ranges[n].len = b->size;
+		n++;
+		blocked = 0;
+	}
+	return n;
+}
+
+static int i2c_read(struct tinygps *dev, const struct range *r, unsigned n,
+		uint8_t *regs)
+{
+	struct i2c_msg msgs[2*TINYGPS_BANK_COUNT];
+	uint8_t offsets[TINYGPS_BANK_COUNT];
+	for (unsigned i = 0; i < n; i++) {
+		offsets[i] = r[i].offset;
+		msgs[2*i] = (struct i2c_msg){ dev->address, 0, 1, &offsets[i] };
+		msgs[2*i+1] = (struct i2c_msg){ dev->address, I2C_M_RD,
+				r[i].len, regs + r[i].offset };
+	}
+	if (!dev->single_pair) {
+		struct i2c_rdwr_ioctl_data data = { msgs, 2*n };
+		if (ioctl(dev->fd, I2C_RDWR, &data) >= 0) {
+			return 0;
+		}
+		if (n == 1 || errno != EOPNOTSUPP) {
+			return -1;
+		}
+		dev->single_pair = 1;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		struct i2c_rdwr_ioctl_data data = { &msgs[2*i], 2 };
+		if (ioctl(dev->fd, I2C_RDWR, &data) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int smbus_block(struct tinygps *dev, char rw, uint8_t offset,
+		uint8_t *buf, uint8_t len)
+{
+	union i2c_smbus_data block;
+	struct i2c_smbus_ioctl_data args = {
+		rw, offset, I2C_SMBUS_I2C_BLOCK_DATA, &block
+	};
+	block.block[0] = len;
+	if (rw == I2C_SMBUS_WRITE) {
+		memcpy(&block.block[1], buf, len);
+	}
+	if (ioctl(dev->fd, I2C_SMBUS, &args) < 0) {
+		return -1;
+	}
+	if (rw == I2C_SMBUS_READ) {
+		memcpy(buf, &block.block[1], len);
+	}
+	return 0;
+}
+
+static int smbus_read(struct tinygps *dev, const struct range *r, unsigned n,
+		uint8_t *regs)
+{
+	for (unsigned i = 0; i < n; i++) {
+		for (unsigned done = 0; done < r[i].len; done += SMBUS_BLOCK) {
+			unsigned len = r[i].len - done;
+			uint8_t offset = r[i].offset + done;
+			if (len > SMBUS_BLOCK) {
+				len = SMBUS_BLOCK;
+			}
+			if (smbus_block(dev, I2C_SMBUS_READ, offset, regs + offset, len) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int emulator_read(struct tinygps *dev, const struct range *r,
+		unsigned n, uint8_t *regs)
+{
+	pthread_mutex_lock(&dev->image_lock);
+	for (unsigned i = 0; i < n; i++) {
+		memcpy(regs + r[i].offset, dev->image + r[i].offset, r[i].len);
+	}
+	pthread_mutex_unlock(&dev->image_lock);
+	return 0;
+}
+
+static int read_ranges(struct tinygps *dev, const struct range *r, unsigned n,
+		struct tinygps_nav_data *regs)
+{
+	int ret;
+	switch (dev->backend) {
+	case BACKEND_I2C:
+		ret = i2c_read(dev, r, n, (uint8_t *)regs);
+		break;
+	case BACKEND_SMBUS:
+		ret = smbus_read(dev, r, n, (uint8_t *)regs);
+		break;
+	default:
+		ret = emulator_read(dev, r, n, (uint8_t *)regs);
+		break;
+	}
+	if (ret == 0 && regs->version != TINYGPS_VERSION) {
+		errno = EPROTO;
+		return -1;
+	}
+	return ret;
+}
+
+int tinygps_read(struct tinygps *dev, unsigned long mask,
+		struct tinygps_nav_data *regs)
+{
+	struct range ranges[TINYGPS_BANK_COUNT];
+	unsigned n = plan(mask | TINYGPS_BANK(VERSION), ranges);
+	return read_ranges(dev, ranges, n, regs);
+}
+
+/* a write transfer to the bus, which may go past the register image */
+static int bus_write(struct tinygps *dev, uint8_t offset,
+		const void *data, size_t len)
+{
+	if (dev->backend == BACKEND_SMBUS) {
+		for (size_t done = 0; done < len; done += SMBUS_BLOCK) {
+			size_t n = len - done < SMBUS_BLOCK ? len - done : SMBUS_BLOCK;
+			if (smbus_block(dev, I2C_SMBUS_WRITE, offset + done,
+					(uint8_t *)data + done, n) < 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+	uint8_t buf[1 + UINT8_MAX + 1];
+	buf[0] = offset;
+	memcpy(buf + 1, data, len);
+	struct i2c_msg msg = { dev->address, 0, 1 + len, buf };
+	struct i2c_rdwr_ioctl_data rdwr = { &msg, 1 };
+	return ioctl(dev->fd, I2C_RDWR, &rdwr) < 0 ? -1 : 0;
+}
+
+int tinygps_write(struct tinygps *dev, uint8_t offset,
+		const void *data, size_t len)
+{
+	if (offset + len > TINYGPS_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dev->backend == BACKEND_EMULATOR) {
+		return tinygps_emulator_set(dev, offset, data, len);
+	}
+	return bus_write(dev, offset, data, len);
+}
+
+#if TINYGPS_HAS_FORWARD
+int tinygps_forward(struct tinygps *dev, const void *data, size_t len)
+{
+	const uint8_t offset = offsetof(struct tinygps_nav_data, forward.data);
+	if (len > SMBUS_BLOCK) {
+		len = SMBUS_BLOCK;
+	}
+	if (dev->backend == BACKEND_EMULATOR) {
+		/* there is no receiver to feed */
+		return len;
+	}
+	struct tinygps_nav_data regs;
+	if (tinygps_read(dev, TINYGPS_BANK(FORWARD), &regs) < 0) {
+		return -1;
+	}
+	if (len > regs.forward.free) {
+		len = regs.forward.free;
+	}
+	/* the offset must not wrap around within the transfer */
+	if (offset + len > UINT8_MAX + 1) {
+		len = UINT8_MAX + 1 - offset;
+	}
+	if (len && bus_write(dev, offset, data, len) < 0) {
+		return -1;
+	}
+	return len;
+}
+#endif
+
+int tinygps_latch_all(struct tinygps *dev)
+{
+	uint8_t command = TINYGPS_TWI_GCALL_LATCH;
+	if (dev->backend == BACKEND_EMULATOR) {
+		return 0;
+	}
+	if (dev->backend == BACKEND_SMBUS) {
+		/* the adapter is bound to the address of dev */
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	struct i2c_msg msg = { 0, 0, 1, &command };
+	struct i2c_rdwr_ioctl_data rdwr = { &msg, 1 };
+	return ioctl(dev->fd, I2C_RDWR, &rdwr) < 0 ? -1 : 0;
+}
+
+int tinygps_emulator_set(struct tinygps *dev, uint8_t offset,
+		const void *data, size_t len)
+{
+	if (dev->backend != BACKEND_EMULATOR || offset + len > TINYGPS_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&dev->image_lock);
+	memcpy(dev->image + offset, data, len);
+	pthread_mutex_unlock(&dev->image_lock);
+	return 0;
+}
+
+/* digits are stored from the low nibble of the first byte on */
+static double bcd_fraction(const uint8_t *bcd, unsigned digits)
+{
+	double f = 0, scale = 0.1;
+	for (unsigned i = 0; i < digits; i++) {
+		unsigned d = i % 2 ? bcd[i/2] >> 4 : bcd[i/2] & 0x0f;
+		f += d * scale;
+		scale /= 10;
+	}
+	return f;
+}
+
+static double degrees(const struct tinygps_coord *c, int positive)
+{
+	double deg = c->deg + (c->min +
+		bcd_fraction(c->frac, TINYGPS_NMEA_MINUTE_FRACTS)) / 60;
+	return positive ? deg : -deg;
+}
+
+double tinygps_latitude(const struct tinygps_nmea_data *gps)
+{
+	return degrees(&gps->lat,
+		gps->flags & 1 << TINYGPS_NMEA_RMC_FLAGS_LAT_NORTH);
+}
+
+double tinygps_longitude(const struct tinygps_nmea_data *gps)
+{
+	return degrees(&gps->lon,
+		gps->flags & 1 << TINYGPS_NMEA_RMC_FLAGS_LON_EAST);
+}
+
+double tinygps_altitude(const struct tinygps_nmea_data *gps)
+{
+	double frac = bcd_fraction(gps->alt.frac, TINYGPS_NMEA_ALTITUDE_FRACTS);
+	return gps->alt.m < 0 ? gps->alt.m - frac : gps->alt.m + frac;
+}
+
+static struct tinygps *alloc(enum backend backend)
+{
+	struct tinygps *dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		return NULL;
+	}
+	dev->backend = backend;
+	dev->fd = -1;
+	dev->image[0] = TINYGPS_VERSION;
+	pthread_mutex_init(&dev->image_lock, NULL);
+	pthread_mutex_init(&dev->lock, NULL);
+	return dev;
+}
+
+struct tinygps *tinygps_open(const char *bus, uint8_t address)
+{
+	struct tinygps *dev = alloc(BACKEND_I2C);
+	unsigned long funcs;
+	struct tinygps_nav_data regs;
+	if (!dev) {
+		return NULL;
+	}
+	dev->address = address;
+	dev->fd = open(bus, O_RDWR | O_CLOEXEC);
+	if (dev->fd < 0 || ioctl(dev->fd, I2C_FUNCS, &funcs) < 0) {
+		goto fail;
+	}
+	if (!(funcs & I2C_FUNC_I2C)) {
+		/* e.g. i2c-stub: fall back to SMBus block transfers */
+		if ((funcs & I2C_FUNC_SMBUS_I2C_BLOCK) != I2C_FUNC_SMBUS_I2C_BLOCK) {
+			errno = EOPNOTSUPP;
+			goto fail;
+		}
+		if (ioctl(dev->fd, I2C_SLAVE, address) < 0) {
+			goto fail;
+		}
+		dev->backend = BACKEND_SMBUS;
+	}
+	if (tinygps_read(dev, TINYGPS_BANK(VERSION), &regs) < 0) {
+		goto fail;
+	}
+	return dev;
+fail:
+	tinygps_close(dev);
+	return NULL;
+}
+
+struct tinygps *tinygps_open_emulator(void)
+{
+	return alloc(BACKEND_EMULATOR);
+}
+
+void tinygps_close(struct tinygps *dev)
+{
+	int err = errno;
+	if (!dev) {
+		return;
+	}
+	tinygps_poll_stop(dev);
+	if (dev->fd >= 0) {
+		close(dev->fd);
+	}
+	pthread_mutex_destroy(&dev->image_lock);
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+	errno = err;
+}
+
+static long elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000L +
+		(to->tv_nsec - from->tv_nsec);
+}
+
+static void advance(struct timespec *t, long ns)
+{
+	t->tv_nsec += ns;
+	while (t->tv_nsec >= 1000000000L) {
+		t->tv_nsec -= 1000000000L;
+		t->tv_sec++;
+	}
+}
+
+static void record(struct tinygps *dev, int ok, long jitter, long xfer)
+{
+	struct tinygps_stats *s = &dev->stats;
+	if (!ok) {
+		s->errors++;
+		return;
+	}
+	if (!s->samples || jitter < s->jitter_min) {
+		s->jitter_min = jitter;
+	}
+	if (!s->samples || jitter > s->jitter_max) {
+		s->jitter_max = jitter;
+	}
+	if (!s->samples || xfer < s->xfer_min) {
+		s->xfer_min = xfer;
+	}
+	if (!s->samples || xfer > s->xfer_max) {
+		s->xfer_max = xfer;
+	}
+	s->samples++;
+	dev->jitter_sum += jitter;
+	dev->xfer_sum += xfer;
+}
+
+static void *poll_thread(void *arg)
+{
+	struct tinygps *dev = arg;
+	struct tinygps_nav_data regs;
+	struct range ranges[TINYGPS_BANK_COUNT];
+	struct timespec next, start, end;
+	unsigned n = plan(dev->poll_banks | TINYGPS_BANK(VERSION), ranges);
+
+	memset(&regs, 0, sizeof(regs));
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+		pthread_mutex_lock(&dev->lock);
+		int polling = dev->polling;
+		pthread_mutex_unlock(&dev->lock);
+		if (!polling) {
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		int ok = read_ranges(dev, ranges, n, &regs) == 0;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		pthread_mutex_lock(&dev->lock);
+		record(dev, ok, elapsed(&next, &start), elapsed(&start, &end));
+		pthread_mutex_unlock(&dev->lock);
+		if (ok) {
+			dev->fn(&regs, dev->poll_banks, &start, dev->arg);
+		}
+
+		/* keep the schedule, dropping the periods already missed */
+		advance(&next, dev->period);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		long behind = elapsed(&next, &end);
+		if (behind > 0) {
+			unsigned long missed = behind / dev->period + 1;
+			advance(&next, missed * dev->period);
+			pthread_mutex_lock(&dev->lock);
+			dev->stats.overruns += missed;
+			pthread_mutex_unlock(&dev->lock);
+		}
+	}
+	return NULL;
+}
+
+int tinygps_poll_start(struct tinygps *dev, unsigned long banks,
+		unsigned rate_hz, tinygps_sample_fn fn, void *arg)
+{
+	if (dev->polling || !rate_hz || !fn) {
+		errno = dev->polling ? EBUSY : EINVAL;
+		return -1;
+	}
+	dev->poll_banks = banks;
+	dev->period = 1000000000L / rate_hz;
+	dev->fn = fn;
+	dev->arg = arg;
+	dev->polling = 1;
+	tinygps_poll_stats(dev, NULL, 1);
+	int err = pthread_create(&dev->thread, NULL, poll_thread, dev);
+	if (err) {
+		dev->polling = 0;
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void tinygps_poll_stop(struct tinygps *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	int polling = dev->polling;
+	dev->polling = 0;
+	pthread_mutex_unlock(&dev->lock);
+	if (polling) {
+		pthread_join(dev->thread, NULL);
+	}
+}
+
+void tinygps_poll_stats(struct tinygps *dev, struct tinygps_stats *stats,
+		int reset)
+{
+	pthread_mutex_lock(&dev->lock);
+	if (stats) {
+		*stats = dev->stats;
+		if (dev->stats.samples) {
+			stats->jitter_avg = dev->jitter_sum / (long long)dev->stats.samples;
+			stats->xfer_avg = dev->xfer_sum / (long long)dev->stats.samples;
+		}
+	}
+	if (reset) {
+		memset(&dev->stats, 0, sizeof(dev->stats));
+		dev->jitter_sum = 0;
+		dev->xfer_sum = 0;
+	}
+	pthread_mutex_unlock(&dev->lock);
+}
@@ -0,0 +1,90 @@
+/* master side of the tiny-gps TWI interface for Linux i2c-dev,
+ * the register structs come from tiny-gps-regs.h (see regmap.py)
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "tiny-gps-regs.h"
+
+/* banks of the register window, in the order of TINYGPS_BANKS */
+enum tinygps_bank {
+#define TINYGPS_BANK_ID(id, member, trap) TINYGPS_BANK_##id,
+	TINYGPS_BANKS(TINYGPS_BANK_ID)
+#undef TINYGPS_BANK_ID
+	TINYGPS_BANK_COUNT
+};
+
+/* bank masks, e.g. TINYGPS_BANK(GPS) | TINYGPS_BANK(SONAR) */
+#define TINYGPS_BANK(id) (1UL << TINYGPS_BANK_##id)
+#define TINYGPS_BANK_ALL ((1UL << TINYGPS_BANK_COUNT) - 1)
+
+/* gaps between two requested banks up to this size are read along instead of
+ * starting another transfer, unless the gap holds a bank with side effects
+ */
+#define TINYGPS_MERGE_GAP 4
+
+struct tinygps;
+
+struct tinygps_stats {
+	/* completed and failed reads */
+	unsigned long samples;
+	unsigned long errors;
+	/* periods skipped because a read did not finish in time */
+	unsigned long overruns;
+	/* start of the reads relative to their schedule in ns */
+	long jitter_min;
+	long jitter_max;
+	long jitter_avg;
+	/* duration of the reads in ns */
+	long xfer_min;
+	long xfer_max;
+	long xfer_avg;
+};
+
+/* called by the poller after every successful read: the requested banks of
+ * regs are up to date, t is the monotonic time the read started
+ */
+typedef void (*tinygps_sample_fn)(const struct tinygps_nav_data *regs,
+		unsigned long banks, const struct timespec *t, void *arg);
+
+/* all functions returning int return 0 on success, -1 and errno on failure;
+ * EPROTO means the firmware has another register layout
+ */
+struct tinygps *tinygps_open(const char *bus, uint8_t address);
+/* in-process register image instead of a bus, see tinygps_emulator_set() */
+struct tinygps *tinygps_open_emulator(void);
+void tinygps_close(struct tinygps *dev);
+
+/* read the banks into the corresponding members of regs */
+int tinygps_read(struct tinygps *dev, unsigned long banks,
+		struct tinygps_nav_data *regs);
+/* write registers starting at offset, e.g. the optical configuration */
+int tinygps_write(struct tinygps *dev, uint8_t offset,
+		const void *data, size_t len);
+/* general call: every controller built with TWI_GENERAL_CALL latches its
+ * registers at once, read them afterwards to get synchronised samples
+ */
+int tinygps_latch_all(struct tinygps *dev);
+#if TINYGPS_HAS_FORWARD
+/* pass data to the GPS receiver, e.g. RTCM corrections; returns the number
+ * of bytes the firmware took, which is less than len while its FIFO is full
+ */
+int tinygps_forward(struct tinygps *dev, const void *data, size_t len);
+#endif
+/* change the register image of an emulator */
+int tinygps_emulator_set(struct tinygps *dev, uint8_t offset,
+		const void *data, size_t len);
+
+/* values of the BCD encoded GPS registers in degrees, negative to the
+ * south and west, and in metres
+ */
+double tinygps_latitude(const struct tinygps_nmea_data *gps);
+double tinygps_longitude(const struct tinygps_nmea_data *gps);
+double tinygps_altitude(const struct tinygps_nmea_data *gps);
+
+/* read the banks rate_hz times per second in a thread of its own */
+int tinygps_poll_start(struct tinygps *dev, unsigned long banks,
+		unsigned rate_hz, tinygps_sample_fn fn, void *arg);
+void tinygps_poll_stop(struct tinygps *dev);
+void tinygps_poll_stats(struct tinygps *dev, struct tinygps_stats *stats,
+		int reset);
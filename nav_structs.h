@@ -1,5 +0,0 @@
-struct nav_data_t {
-	struct nmea_data_t gps;
-	struct sonar_data_t sonar;
-	struct optical_data_t optical;
-};
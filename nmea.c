@@ -3,7 +3,9 @@
 /* NMEA parser */
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
+#include <avr/pgmspace.h>
 
 #include "nmea.h"
 
@@ -27,6 +29,9 @@ static union {
 #if PARSE_GPS_NMEA_GGA
 	struct nmea_gga_t gga;
 #endif
+#if GPS_NEGOTIATE
+	struct nmea_ack_t ack;
+#endif
 } nmea_wip;
 
 /* this is the data we will be offering */
@@ -36,6 +41,7 @@ static enum {
 	GP_UNKNOWN,
 	GP_RMC,
 	GP_GGA,
+	GP_PMTK001,
 } sentence = GP_UNKNOWN;
 
 static enum {
@@ -48,6 +54,34 @@ static enum {
 
 static uint8_t checksum = 0;
 
+/* number of sentences received with a valid checksum */
+static uint8_t valid_sentences = 0;
+#if GPS_NEGOTIATE
+/* number of valid sentences we do not parse */
+static uint8_t other_sentences = 0;
+/* the last acknowledgement received */
+static struct nmea_ack_t last_ack = { 0, NMEA_ACK_NONE };
+#endif
+
+#if USE_NMEA_STATS
+static struct nmea_stats_t *stats = NULL;
+/* fields of the current sentence that did not fit into the token buffer */
+static uint8_t truncated_tokens = 0;
+static uint8_t token_truncated = 0;
+/* a $ has been seen since the last line break */
+static uint8_t sentence_open = 0;
+#endif
+
+#if NMEA_PARSE_COURSE
+/* the last known course over ground in degrees */
+static uint16_t course = NMEA_COURSE_UNKNOWN;
+#endif
+
+#if NMEA_FIX_HANDLER
+/* called whenever a fix has been copied to the output */
+static void (*fix_handler)(uint8_t position) = NULL;
+#endif
+
 static uint8_t token_nr = 0;
 
 #define TOKEN_BUFFER_SIZE 11
@@ -134,181 +168,204 @@ static void parse_date(struct date_t *d) {
 }
 #endif
 
+#define NMEA_PARSE_FIELDS (PARSE_GPS_NMEA_RMC || PARSE_GPS_NMEA_GGA || GPS_NEGOTIATE)
+
+#if NMEA_PARSE_FIELDS
+/* decoders of the fields; the values below FIELD_CLOCK are bit numbers:
+ * that bit of the destination is set if the field starts with the match
+ * character, or, if that is '\0', holds a number other than 0
+ */
+enum {
+	FIELD_CLOCK = 8,
+	FIELD_DATE,
+	FIELD_COORD,
+	FIELD_ALTITUDE,
+	FIELD_UINT8,
+	/* empty fields read 0xFFFF */
+	FIELD_UINT16,
+};
+
+/* a field of a sentence to be decoded into nmea_wip */
+struct nmea_field_t {
+	uint8_t token;
+	uint8_t decode;
+	uint8_t offset;
+	char match;
+};
+
+#define FIELD(token, decode, type, member, match) \
+	{ token, decode, offsetof(type, member), match },
+/* ends a table, the fields are sorted by token */
+#define FIELDS_END { 0, 0, 0, 0 }
+
 #if PARSE_GPS_NMEA_RMC
-static void process_gprmc_token(void) {
-	switch (token_nr) {
-#if !PARSE_GPS_NMEA_GGA /* avoid duplicate parsing code */
+static const struct nmea_field_t rmc_fields[] PROGMEM = {
 #if PARSE_GPS_TIME
-		case 1:
-			/* time
-			 * HHMMSS(.sssss)
-			 */
-			parse_clock(&nmea_wip.rmc.clock);
-			break;
+	/* time, HHMMSS(.sssss) */
+	FIELD(1, FIELD_CLOCK, struct nmea_rmc_t, clock, 0)
 #endif
-		case 2:
-			/* status
-			 * A OK
-			 * V Warning
-			 */
-			if (token_buffer[0] == 'A') {
-				nmea_wip.rmc.flags |= (1<<NMEA_RMC_FLAGS_STATUS_OK);
-			} else {
-				nmea_wip.rmc.flags &= ~(1<<NMEA_RMC_FLAGS_STATUS_OK);
-			}
-			break;
-		case 3:
-			/* latitude
-			 * BBBB.BBBB
-			 */
-			parse_coord(&nmea_wip.rmc.lat);
-			break;
-		case 4:
-			/* orientation
-			 * N north
-			 * S south
-			 */
-			if (token_buffer[0] == 'N') {
-				nmea_wip.rmc.flags |= (1<<NMEA_RMC_FLAGS_LAT_NORTH);
-			} else {
-				nmea_wip.rmc.flags &= ~(1<<NMEA_RMC_FLAGS_LAT_NORTH);
-			}
-			break;
-		case 5:
-			/* longitude
-			 * LLLLL.LLLL
-			 */
-			parse_coord(&nmea_wip.rmc.lon);
-			break;
-		case 6:
-			/* orientation
-			 * E east
-			 * W west
-			 */
-			if (token_buffer[0] == 'E') {
-				nmea_wip.rmc.flags |= (1<<NMEA_RMC_FLAGS_LON_EAST);
-			} else {
-				nmea_wip.rmc.flags &= ~(1<<NMEA_RMC_FLAGS_LON_EAST);
-			}
-
-			break;
+#if !PARSE_GPS_NMEA_GGA /* the position is taken from GGA */
+	/* status, A OK or V warning */
+	FIELD(2, NMEA_RMC_FLAGS_STATUS_OK, struct nmea_rmc_t, flags, 'A')
+	/* latitude, BBBB.BBBB, and N north or S south */
+	FIELD(3, FIELD_COORD, struct nmea_rmc_t, lat, 0)
+	FIELD(4, NMEA_RMC_FLAGS_LAT_NORTH, struct nmea_rmc_t, flags, 'N')
+	/* longitude, LLLLL.LLLL, and E east or W west */
+	FIELD(5, FIELD_COORD, struct nmea_rmc_t, lon, 0)
+	FIELD(6, NMEA_RMC_FLAGS_LON_EAST, struct nmea_rmc_t, flags, 'E')
+#endif
+	/* 7 speed, GG.G */
+#if NMEA_PARSE_COURSE
+	/* course, RR.R, empty while we are not moving */
+	FIELD(8, FIELD_UINT16, struct nmea_rmc_t, course, 0)
 #endif
-		case 7:
-			/* speed
-			 * GG.G
-			 */
-			break;
-		case 8:
-			/* course
-			 * RR.R
-			 */
-			break;
 #if PARSE_GPS_TIME
-		case 9:
-			/* date
-			 * DDMMYY
-			 */
-			parse_date(&nmea_wip.rmc.date);
-			break;
+	/* date, DDMMYY */
+	FIELD(9, FIELD_DATE, struct nmea_rmc_t, date, 0)
 #endif
-		case 10:
-			/* magnetic declination
-			 * M.M
-			 */
-			break;
-		case 11:
-			/* sign of declination
-			 * E east
-			 * W west
-			 */
-			break;
-		case 12:
-			/* signal integrity
-			 * A autonomous mode
-			 * D differential mode
-			 * E estimated mode
-			 * M manual input mode
-			 * S simulated mode
-			 * N data not valid
-			 */
-			break;
-	}
-}
+	/* 10 magnetic declination, M.M
+	 * 11 sign of declination, E east or W west
+	 * 12 signal integrity, A autonomous, D differential, E estimated,
+	 *    M manual input, S simulated or N data not valid
+	 */
+	FIELDS_END
+};
+#endif
+
+#if PARSE_GPS_NMEA_GGA
+static const struct nmea_field_t gga_fields[] PROGMEM = {
+#if PARSE_GPS_TIME
+	/* time, HHMMSS(.sssss) */
+	FIELD(1, FIELD_CLOCK, struct nmea_gga_t, clock, 0)
+#endif
+	/* latitude, BBBB.BBBB, and N north or S south */
+	FIELD(2, FIELD_COORD, struct nmea_gga_t, lat, 0)
+	FIELD(3, NMEA_RMC_FLAGS_LAT_NORTH, struct nmea_gga_t, flags, 'N')
+	/* longitude, LLLLL.LLLL, and E east or W west */
+	FIELD(4, FIELD_COORD, struct nmea_gga_t, lon, 0)
+	FIELD(5, NMEA_RMC_FLAGS_LON_EAST, struct nmea_gga_t, flags, 'E')
+	/* signal quality, 0 means there is no fix */
+	FIELD(6, FIELD_UINT8, struct nmea_gga_t, quality, 0)
+	FIELD(6, NMEA_RMC_FLAGS_STATUS_OK, struct nmea_gga_t, flags, 0)
+	/* number of used satellites */
+	FIELD(7, FIELD_UINT8, struct nmea_gga_t, sats, 0)
+#if PARSE_GPS_ALTITUDE
+	/* altitude */
+	FIELD(9, FIELD_ALTITUDE, struct nmea_gga_t, alt, 0)
+#endif
+	FIELDS_END
+};
+#endif
+
+#if GPS_NEGOTIATE
+static const struct nmea_field_t pmtk001_fields[] PROGMEM = {
+	/* acknowledged command */
+	FIELD(1, FIELD_UINT16, struct nmea_ack_t, cmd, 0)
+	/* result
+	 * 0 invalid command
+	 * 1 unsupported command
+	 * 2 valid command, but action failed
+	 * 3 valid command, action succeeded
+	 */
+	FIELD(2, FIELD_UINT8, struct nmea_ack_t, flag, 0)
+	FIELDS_END
+};
 #endif
 
+struct nmea_sentence_t {
+	char name[8];
+	uint8_t type;
+	const struct nmea_field_t *fields;
+};
+
+static const struct nmea_sentence_t sentences[] PROGMEM = {
+#if PARSE_GPS_NMEA_RMC
+	{ "GPRMC", GP_RMC, rmc_fields },
+#endif
 #if PARSE_GPS_NMEA_GGA
-static void process_gpgga_token(void) {
-	switch (token_nr) {
+	{ "GPGGA", GP_GGA, gga_fields },
+#endif
+#if GPS_NEGOTIATE
+	{ "PMTK001", GP_PMTK001, pmtk001_fields },
+#endif
+};
+
+#define SENTENCES (sizeof(sentences)/sizeof(sentences[0]))
+
+/* the next field of the current sentence to be decoded */
+static const struct nmea_field_t *field;
+
+static void decode_field(const struct nmea_field_t *f) {
+	uint8_t decode = pgm_read_byte(&f->decode);
+	void *dst = (uint8_t *)&nmea_wip + pgm_read_byte(&f->offset);
+	switch (decode) {
 #if PARSE_GPS_TIME
-		case 1:
-			/* time
-			 * HHMMSS(.sssss)
-			 */
-			parse_clock(&nmea_wip.gga.clock);
+		case FIELD_CLOCK:
+			parse_clock(dst);
+			break;
+		case FIELD_DATE:
+			parse_date(dst);
 			break;
 #endif
-		case 2:
-			/* latitude
-			 * BBBB.BBBB
-			 */
-			parse_coord(&nmea_wip.gga.lat);
+		case FIELD_COORD:
+			parse_coord(dst);
 			break;
-		case 3:
-			/* orientation
-			 * N north
-			 * S south
-			 */
-			if (token_buffer[0] == 'N') {
-				nmea_wip.gga.flags |= (1<<NMEA_RMC_FLAGS_LAT_NORTH);
-			} else {
-				nmea_wip.gga.flags &= ~(1<<NMEA_RMC_FLAGS_LAT_NORTH);
-			}
+#if PARSE_GPS_ALTITUDE
+		case FIELD_ALTITUDE:
+			parse_altitude(dst);
 			break;
-		case 4:
-			/* longitude
-			 * LLLLL.LLLL
-			 */
-			parse_coord(&nmea_wip.gga.lon);
+#endif
+		case FIELD_UINT8:
+			*(uint8_t *)dst = atoi(token_buffer);
 			break;
-		case 5:
-			/* orientation
-			 * E east
-			 * W west
-			 */
-			if (token_buffer[0] == 'E') {
-				nmea_wip.gga.flags |= (1<<NMEA_RMC_FLAGS_LON_EAST);
-			} else {
-				nmea_wip.gga.flags &= ~(1<<NMEA_RMC_FLAGS_LON_EAST);
-			}
-
+		case FIELD_UINT16:
+			*(uint16_t *)dst = token_buffer[0] ? atoi(token_buffer) : 0xFFFF;
 			break;
-		case 6:
-			/* signal quality */
-			nmea_wip.gga.quality = atoi(token_buffer);
-			if (nmea_wip.gga.quality) {
-				nmea_wip.gga.flags |= (1<<NMEA_RMC_FLAGS_STATUS_OK);
+		default: {
+			char match = pgm_read_byte(&f->match);
+			if (match ? token_buffer[0] == match : atoi(token_buffer) != 0) {
+				*(uint8_t *)dst |= 1<<decode;
 			} else {
-				nmea_wip.gga.flags &= ~(1<<NMEA_RMC_FLAGS_STATUS_OK);
+				*(uint8_t *)dst &= ~(1<<decode);
 			}
 			break;
-		case 7:
-			/* number of used satellites */
-			nmea_wip.gga.sats = atoi(token_buffer);
-			break;
-#if PARSE_GPS_ALTITUDE
-		case 9:
-			/* altitude */
-			parse_altitude(&nmea_wip.gga.alt);
-			break;
+		}
+	}
+}
 #endif
-		default:
-			/* nothing to do */
-			break;
+
+#if USE_NMEA_STATS
+static void count_sentence(void) {
+	if (!sentence_open) {
+		/* a line break or noise without a sentence */
+		return;
 	}
+	sentence_open = 0;
+	struct nmea_type_stats_t *t = &stats->type[
+		sentence == GP_RMC ? NMEA_STATS_RMC :
+		sentence == GP_GGA ? NMEA_STATS_GGA : NMEA_STATS_OTHER];
+	t->received++;
+	if (checksum_state == CS_INVALID) {
+		t->checksum_errors++;
+	} else {
+		t->accepted++;
+		if (checksum_state != CS_VALID) {
+			t->no_checksum++;
+		}
+	}
+	t->truncated += truncated_tokens;
 }
 #endif
 
 static void sentence_started(void) {
+#if USE_NMEA_STATS
+	/* the previous sentence did not see its line break */
+	if (sentence_open) {
+		stats->aborted++;
+	}
+	sentence_open = 1;
+	truncated_tokens = 0;
+#endif
 	/* a new sentence has started, we do not know which yet */
 	sentence = GP_UNKNOWN;
 	/* clear token buffer */
@@ -321,9 +378,15 @@ static void sentence_finished(void) {
 	 * now copy the constructed data to the ouput struct
 	 * if the checksum matches.
 	 */
+#if USE_NMEA_STATS
+	count_sentence();
+#endif
 	if (checksum_state == CS_INVALID) {
 		return;
 	}
+	if (checksum_state == CS_VALID) {
+		valid_sentences++;
+	}
 	switch (sentence) {
 #if PARSE_GPS_NMEA_RMC
 		case GP_RMC:
@@ -336,6 +399,9 @@ static void sentence_finished(void) {
 			nmea_data->flags = nmea_wip.rmc.flags;
 			memcpy(&nmea_data->lon, &nmea_wip.rmc.lon, sizeof(nmea_wip.rmc.lon));
 			memcpy(&nmea_data->lat, &nmea_wip.rmc.lat, sizeof(nmea_wip.rmc.lat));
+#endif
+#if NMEA_PARSE_COURSE
+			course = nmea_wip.rmc.course;
 #endif
 			break;
 #endif
@@ -355,49 +421,60 @@ static void sentence_finished(void) {
 			memcpy(&nmea_data->alt, &nmea_wip.gga.alt, sizeof(nmea_wip.gga.alt));
 #endif
 			break;
+#endif
+#if GPS_NEGOTIATE
+		case GP_PMTK001:
+			last_ack = nmea_wip.ack;
+			break;
 #endif
 		default:
+#if GPS_NEGOTIATE
+			if (checksum_state == CS_VALID) {
+				other_sentences++;
+			}
+#endif
 			break;
 	}
+#if NMEA_FIX_HANDLER
+	if ((sentence == GP_RMC || sentence == GP_GGA) && fix_handler) {
+		/* the position is taken from GGA if we parse it */
+		fix_handler(sentence == (PARSE_GPS_NMEA_GGA ? GP_GGA : GP_RMC));
+	}
+#endif
 }
 
 static void gp_token_finished(void) {
 	/* a token of the nmea sentence has been completed */
-	switch (sentence) {
-		case GP_UNKNOWN:
-			if (token_nr == 0) {
-				/* clear the building site */
-				memset(&nmea_wip, 0, sizeof(nmea_wip));
-				/* the first token defines the sentence type */
-#if PARSE_GPS_NMEA_RMC
-				if (strcmp(token_buffer, "GPRMC") == 0) {
-					sentence = GP_RMC;
-				} else
-#endif
-#if PARSE_GPS_NMEA_GGA
-				if (strcmp(token_buffer, "GPGGA") == 0) {
-					sentence = GP_GGA;
+	if (sentence == GP_UNKNOWN) {
+		if (token_nr == 0) {
+			/* clear the building site */
+			memset(&nmea_wip, 0, sizeof(nmea_wip));
+#if NMEA_PARSE_FIELDS
+			/* the first token defines the sentence type */
+			for (uint8_t i=0; i<SENTENCES; i++) {
+				if (strcmp_P(token_buffer, sentences[i].name) == 0) {
+					sentence = pgm_read_byte(&sentences[i].type);
+					field = (const struct nmea_field_t *)pgm_read_word(&sentences[i].fields);
+					break;
 				}
-#else
-				{}
-#endif
 			}
-			break;
-#if PARSE_GPS_NMEA_RMC
-		case GP_RMC:
-			/* process data of the minimal data set */
-			process_gprmc_token();
-			break;
 #endif
-#if PARSE_GPS_NMEA_GGA
-		case GP_GGA:
-			process_gpgga_token();
-			break;
+#if GPS_NEGOTIATE
+			if (sentence == GP_PMTK001) {
+				nmea_wip.ack.flag = NMEA_ACK_NONE;
+			}
 #endif
-		default:
-			/* don't know what to do with it */
-			break;
+		}
 	}
+#if NMEA_PARSE_FIELDS
+	else {
+		/* the fields table ends with token 0, which is never reached again */
+		while (token_nr && pgm_read_byte(&field->token) == token_nr) {
+			decode_field(field);
+			field++;
+		}
+	}
+#endif
 	token_buffer[0] = '\0';
 	token_nr++;
 }
@@ -429,6 +506,9 @@ static uint8_t hex_to_short(char *s) {
 
 static void token_finished(void) {
 	/* a token has been completed, process the content in the buffer */
+#if USE_NMEA_STATS
+	token_truncated = 0;
+#endif
 	if (checksum_state != CS_READ) {
 		/* it was a normal token and not the checksum */
 		gp_token_finished();
@@ -453,6 +533,12 @@ static void append_to_token(const char c) {
 		token_buffer[l] = c;
 		token_buffer[l+1] = '\0';
 	}
+#if USE_NMEA_STATS
+	else if (!token_truncated) {
+		token_truncated = 1;
+		truncated_tokens++;
+	}
+#endif
 }
 
 static void add_to_checksum(const char c) {
@@ -463,6 +549,46 @@ void nmea_init(struct nmea_data_t *output) {
 	nmea_data = output;
 }
 
+#if USE_NMEA_STATS
+void nmea_stats_init(struct nmea_stats_t *output) {
+	stats = output;
+}
+#endif
+
+#if NMEA_FIX_HANDLER
+void nmea_set_fix_handler(void (*handler)(uint8_t position)) {
+	fix_handler = handler;
+}
+#endif
+
+uint8_t nmea_valid_sentences(void) {
+	return valid_sentences;
+}
+
+#if NMEA_PARSE_COURSE
+uint16_t nmea_course(void) {
+	return course;
+}
+#endif
+
+#if GPS_NEGOTIATE
+uint8_t nmea_other_sentences(void) {
+	return other_sentences;
+}
+
+/* fetch the result of the last acknowledgement for cmd,
+ * NMEA_ACK_NONE if none has been received
+ */
+uint8_t nmea_take_ack(uint16_t cmd) {
+	uint8_t flag = NMEA_ACK_NONE;
+	if (last_ack.cmd == cmd) {
+		flag = last_ack.flag;
+		last_ack.flag = NMEA_ACK_NONE;
+	}
+	return flag;
+}
+#endif
+
 void nmea_process_character(char c) {
 	switch (c) {
 		case '$': /* a new sentence is starting */
@@ -1,4 +1,8 @@
-#include "nmea_structs.h"
+#include "regmap.h"
+
+/* parse the course over ground from RMC, see nmea_course() */
+#define NMEA_PARSE_COURSE (USE_FUSION)
+#define NMEA_COURSE_UNKNOWN 0xFFFF
 
 struct nmea_rmc_t {
 	/* flag bits (lsb to msb):
@@ -13,6 +17,9 @@ struct nmea_rmc_t {
 #endif
 	struct coord lat;
 	struct coord lon;
+#if NMEA_PARSE_COURSE
+	uint16_t course;
+#endif
 };
 
 struct nmea_gga_t {
@@ -29,6 +36,26 @@ struct nmea_gga_t {
 	uint8_t sats;
 };
 
+#if GPS_NEGOTIATE
+/* acknowledgement of a PMTK command */
+struct nmea_ack_t {
+	uint16_t cmd;
+	uint8_t flag;
+};
+
+#define NMEA_ACK_NONE 0xFF
+#define NMEA_ACK_SUCCESS 3
+#endif
+
+/* somebody wants to know about every new fix */
+#define NMEA_FIX_HANDLER (USE_PPS || USE_FUSION || USE_ENU)
+
 void nmea_init(struct nmea_data_t *output);
+void nmea_stats_init(struct nmea_stats_t *output);
+void nmea_set_fix_handler(void (*handler)(uint8_t position));
 void nmea_process_character(char c);
+uint8_t nmea_valid_sentences(void);
+uint16_t nmea_course(void);
+uint8_t nmea_other_sentences(void);
+uint8_t nmea_take_ack(uint16_t cmd);
 
@@ -3,10 +3,15 @@
 /* optical flow sensor handler */
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include "hal.h"
 #include "optical.h"
+#include "tick.h"
+#include "power.h"
+#include "alarm.h"
 
 #if __AVR__
 #include <util/atomic.h>
@@ -15,19 +20,6 @@
 #define ATOMIC(t)
 #endif
 
-#define OPTICAL_SCLK_PORT PORTA
-#define OPTICAL_SDIO_PORT PORTA
-#define OPTICAL_CSEL_PORT PORTB
-#define OPTICAL_SCLK_DDR  DDRA
-#define OPTICAL_SDIO_DDR  DDRA
-#define OPTICAL_CSEL_DDR  DDRB
-#define OPTICAL_SCLK_PIN  PINA
-#define OPTICAL_SDIO_PIN  PINA
-#define OPTICAL_CSEL_PIN  PINB
-#define OPTICAL_SCLK_BIT  PA0
-#define OPTICAL_SDIO_BIT  PA1
-#define OPTICAL_CSEL_BIT  PB6
-
 #define IO_DELAY   4
 
 /* values for ADNS 5050 */
@@ -36,11 +28,79 @@
 #define DX_REG     0x03
 #define DY_REG     0x04
 #define QUAL_REG   0x05
+#define SHUTU_REG  0x06
+#define SHUTL_REG  0x07
+#define PIXMAX_REG 0x08
+#define PIXMIN_REG 0x0a
+#define PIXEL_REG  0x0b
 #define RESET_REG  0x3a
 #define RESET_VAL  0x5a
 #define CTRL1_REG  0x0d
 #define CTRL2_REG  0x19
+/* mouse control bits */
+#define CTRL1_FORCE_AWAKE 0x01
+#define CTRL1_POWER_DOWN  0x02
+/* mouse control 2 bits, resolution is selected by the lower nibble */
+#define CTRL2_RES_EN      0x10
+#define CTRL2_RES_MASK    0x0f
+#define RES_MIN    1
+#define RES_MAX    11
+
+#if OPTICAL_HW_SPI && !HAL_SPI
+	#error "OPTICAL_HW_SPI needs a part with hardware SPI"
+#endif
+
+#if OPTICAL_RESOLUTION < RES_MIN || OPTICAL_RESOLUTION > RES_MAX
+	#error "OPTICAL_RESOLUTION has to be between 1 and 11"
+#endif
+
+/* motion accumulated since the master last read the registers */
+static struct optical_data_t accu = {0};
+
+#if OPTICAL_TAKERS
+/* motion not yet taken by the dead reckoning and the telemetry */
+static int16_t take_dx[OPTICAL_TAKERS];
+static int16_t take_dy[OPTICAL_TAKERS];
+#endif
+
+/* configuration requested by the master, applied by the main loop */
+static volatile struct optical_config_t config_request = {
+	.res = OPTICAL_RESOLUTION,
+	.mode = OPTICAL_FORCE_AWAKE<<OPTICAL_MODE_FORCE_AWAKE,
+};
+static volatile uint8_t config_pending = 1;
+
+#if OPTICAL_MOTION_IRQ
+/* the sensor signalled motion since we last read it */
+static volatile uint8_t motion = 1;
+#endif
+
+#if USE_OPTICAL_DIAG
+/* the sensor array has 19x19 pixels */
+#define FRAME_SIZE (19*19)
 
+static uint16_t last_diag = 0;
+static volatile uint8_t grab_request = 0;
+static uint8_t grabbing = 0;
+/* pixels the master has yet to read */
+static volatile uint16_t grab_left = 0;
+/* pixel to be handed out on the next read */
+static volatile uint8_t grab_pixel = 0;
+#endif
+
+#if OPTICAL_HW_SPI
+static void _spi_write(uint8_t d) {
+	OPTICAL_SDIO_DDR |= 1<<OPTICAL_SDIO_BIT;
+	SPDR = d;
+	while (!(SPSR & 1<<SPIF));
+}
+
+static uint8_t _spi_read(void) {
+	SPDR = 0xFF;
+	while (!(SPSR & 1<<SPIF));
+	return SPDR;
+}
+#else
 static void _spi_write(uint8_t d) {
 	OPTICAL_SDIO_DDR |= 1<<OPTICAL_SDIO_BIT;
 	for (int8_t i=7; i>=0; i--) {
@@ -57,11 +117,7 @@ static void _spi_write(uint8_t d) {
 	}
 }
 
-static uint8_t optical_read(uint8_t addr) {
-	OPTICAL_CSEL_PORT &= ~(1<<OPTICAL_CSEL_BIT);
-	_spi_write(addr);
-	OPTICAL_SDIO_DDR &= ~(1<<OPTICAL_SDIO_BIT);
-	_delay_us(IO_DELAY);
+static uint8_t _spi_read(void) {
 	uint8_t res = 0;
 	for (int8_t i=7; i>=0; i--) {
 		OPTICAL_SCLK_PORT &= ~(1<<OPTICAL_SCLK_BIT);
@@ -72,6 +128,17 @@ static uint8_t optical_read(uint8_t addr) {
 			res |= 1<<i;
 		}
 	}
+	return res;
+}
+#endif
+
+static uint8_t optical_read(uint8_t addr) {
+	OPTICAL_CSEL_PORT &= ~(1<<OPTICAL_CSEL_BIT);
+	_spi_write(addr);
+	/* release SDIO (MOSI with hardware SPI) for the sensor's answer */
+	OPTICAL_SDIO_DDR &= ~(1<<OPTICAL_SDIO_BIT);
+	_delay_us(IO_DELAY);
+	uint8_t res = _spi_read();
 	OPTICAL_CSEL_PORT |= (1<<OPTICAL_CSEL_BIT);
 	return res;
 }
@@ -87,6 +154,10 @@ static void optical_write(uint8_t addr, uint8_t data) {
 }
 
 void optical_init(void) {
+#if OPTICAL_HW_SPI
+	/* master, mode 3, F_CPU/16 */
+	SPCR = 1<<SPE | 1<<MSTR | 1<<CPOL | 1<<CPHA | 1<<SPR0;
+#endif
 	OPTICAL_SCLK_DDR |= 1<<OPTICAL_SCLK_BIT;
 	OPTICAL_SDIO_DDR &= ~(1<<OPTICAL_SDIO_BIT);
 	OPTICAL_CSEL_DDR |= 1<<OPTICAL_CSEL_BIT;
@@ -102,16 +173,238 @@ void optical_init(void) {
 
 	optical_write(RESET_REG, RESET_VAL);
 	_delay_us(50);
+
+#if OPTICAL_MOTION_IRQ
+	/* enable pull-up on the MOTION pin and trigger INT1 on falling edge */
+	OPTICAL_MOTION_PORT |= 1<<OPTICAL_MOTION_BIT;
+	EXT_INT_CTRL |= 1<<ISC11;
+	EXT_INT_MASK |= 1<<INT1;
+#endif
+}
+
+static optical_accu_t optical_accumulate(optical_accu_t a, int8_t d, uint8_t flag) {
+	/* saturate instead of wrapping around */
+	if (d > 0 && a > OPTICAL_ACCU_MAX - d) {
+		accu.flags |= 1<<flag;
+		return OPTICAL_ACCU_MAX;
+	} else if (d < 0 && a < OPTICAL_ACCU_MIN - d) {
+		accu.flags |= 1<<flag;
+		return OPTICAL_ACCU_MIN;
+	}
+	return a + d;
 }
 
-void optical_query(struct optical_data_t *output) {
+void optical_query(void) {
+#if USE_OPTICAL_DIAG
+	/* the frame grabber occupies the sensor */
+	if (grabbing) {
+		return;
+	}
+#endif
+#if OPTICAL_MOTION_IRQ
+	if (!motion) {
+		return;
+	}
+	motion = 0;
+#endif
 	if (optical_read(MOTION_REG)) {
 		int8_t dy = optical_read(DY_REG);
 		int8_t dx = optical_read(DX_REG);
 		ATOMIC(ATOMIC_FORCEON) {
-			output->dx += dx;
-			output->dy += dy;
+			accu.dx = optical_accumulate(accu.dx, dx, OPTICAL_FLAGS_X_OVERFLOW);
+			accu.dy = optical_accumulate(accu.dy, dy, OPTICAL_FLAGS_Y_OVERFLOW);
+		}
+#if OPTICAL_TAKERS
+		for (uint8_t i=0; i<OPTICAL_TAKERS; i++) {
+			take_dx[i] += dx;
+			take_dy[i] += dy;
 		}
+#endif
+#if USE_ALARM
+		alarm_motion(dx, dy);
+#endif
+	}
+#if OPTICAL_MOTION_IRQ
+	/* MOTION is still asserted, so no new edge will arrive */
+	if (!(OPTICAL_MOTION_PIN & 1<<OPTICAL_MOTION_BIT)) {
+		motion = 1;
 	}
+#endif
+}
+
+#if OPTICAL_TAKERS
+/* hand out the motion since the last call by the same taker */
+void optical_take(uint8_t taker, int16_t *dx, int16_t *dy) {
+	*dx = take_dx[taker];
+	*dy = take_dy[taker];
+	take_dx[taker] = 0;
+	take_dy[taker] = 0;
+}
+#endif
+
+/* called from the TWI interrupt before the byte at offset reg of the
+ * optical registers is transmitted; the first byte of each counter
+ * copies the accumulated value to the output struct and clears it,
+ * so the master receives a consistent value and no motion is lost.
+ */
+void optical_latch(struct optical_data_t *output, uint8_t reg) {
+	if (reg == offsetof(struct optical_data_t, dx)) {
+		output->dx = accu.dx;
+		accu.dx = 0;
+		output->flags &= ~(1<<OPTICAL_FLAGS_X_OVERFLOW);
+		output->flags |= accu.flags & 1<<OPTICAL_FLAGS_X_OVERFLOW;
+		accu.flags &= ~(1<<OPTICAL_FLAGS_X_OVERFLOW);
+	} else if (reg == offsetof(struct optical_data_t, dy)) {
+		output->dy = accu.dy;
+		accu.dy = 0;
+		output->flags &= ~(1<<OPTICAL_FLAGS_Y_OVERFLOW);
+		output->flags |= accu.flags & 1<<OPTICAL_FLAGS_Y_OVERFLOW;
+		accu.flags &= ~(1<<OPTICAL_FLAGS_Y_OVERFLOW);
+	}
+}
+
+void optical_config_query(struct optical_config_t *output) {
+#if USE_OPTICAL_DIAG
+	/* the frame grabber occupies the sensor */
+	if (grabbing) {
+		return;
+	}
+#endif
+	if (!config_pending) {
+		return;
+	}
+	uint8_t res, mode;
+	ATOMIC(ATOMIC_FORCEON) {
+		res = config_request.res;
+		mode = config_request.mode;
+		config_pending = 0;
+	}
+	if (res < RES_MIN) {
+		res = RES_MIN;
+	} else if (res > RES_MAX) {
+		res = RES_MAX;
+	}
+	uint8_t ctrl1 = 0;
+	if (mode & 1<<OPTICAL_MODE_FORCE_AWAKE) {
+		ctrl1 |= CTRL1_FORCE_AWAKE;
+	}
+	if (mode & 1<<OPTICAL_MODE_POWER_DOWN) {
+		ctrl1 |= CTRL1_POWER_DOWN;
+	}
+	optical_write(CTRL2_REG, CTRL2_RES_EN | res);
+	optical_write(CTRL1_REG, ctrl1);
+
+	/* publish what the sensor actually accepted */
+	ctrl1 = optical_read(CTRL1_REG);
+	mode = 0;
+	if (ctrl1 & CTRL1_FORCE_AWAKE) {
+		mode |= 1<<OPTICAL_MODE_FORCE_AWAKE;
+	}
+	if (ctrl1 & CTRL1_POWER_DOWN) {
+		mode |= 1<<OPTICAL_MODE_POWER_DOWN;
+	}
+	res = optical_read(CTRL2_REG) & CTRL2_RES_MASK;
+	ATOMIC(ATOMIC_FORCEON) {
+		output->res = res;
+		output->mode = mode;
+	}
+}
+
+/* called from the TWI interrupt when the master writes a config register */
+void optical_set_config(uint8_t reg, uint8_t value) {
+	if (reg == offsetof(struct optical_config_t, res)) {
+		config_request.res = value;
+	} else if (reg == offsetof(struct optical_config_t, mode)) {
+		config_request.mode = value;
+	} else {
+		return;
+	}
+	config_pending = 1;
 }
+
+#if USE_OPTICAL_DIAG
+static void optical_grab_step(struct optical_diag_t *output) {
+	uint16_t left;
+	ATOMIC(ATOMIC_FORCEON) {
+		left = grab_left;
+	}
+	if (left == 0) {
+		/* the entire frame has been read or the grab was aborted */
+		grab_pixel = 0;
+		grabbing = 0;
+		output->frame = 0;
+		return;
+	}
+	if (grab_pixel & 1<<OPTICAL_PIXEL_VALID) {
+		/* the master did not fetch the last pixel yet */
+		return;
+	}
+	/* the valid bit is only set once the pixel is available */
+	grab_pixel = optical_read(PIXEL_REG);
+}
+
+void optical_diag_query(struct optical_diag_t *output) {
+	if (grab_request) {
+		grab_request = 0;
+		/* writing to the register resets the frame grabber */
+		optical_write(PIXEL_REG, 0);
+		grab_pixel = 0;
+		ATOMIC(ATOMIC_FORCEON) {
+			grab_left = FRAME_SIZE;
+		}
+		grabbing = 1;
+		output->frame = 1;
+	}
+	if (grabbing) {
+		optical_grab_step(output);
+		return;
+	}
+	uint16_t now = tick_now();
+	if ((uint16_t)(now - last_diag) < OPTICAL_DIAG_INTERVAL) {
+		return;
+	}
+	last_diag = now;
+	uint8_t squal = optical_read(QUAL_REG);
+	uint16_t shutter = optical_read(SHUTU_REG)<<8;
+	shutter |= optical_read(SHUTL_REG);
+	uint8_t max = optical_read(PIXMAX_REG);
+	uint8_t min = optical_read(PIXMIN_REG);
+	ATOMIC(ATOMIC_FORCEON) {
+		output->squal = squal;
+		output->shutter = shutter;
+		output->max_pixel = max;
+		output->min_pixel = min;
+	}
+}
+
+/* called from the TWI interrupt when the master writes the frame register */
+void optical_frame_grab(uint8_t start) {
+	if (start) {
+		grab_request = 1;
+	} else {
+		/* abort the running grab, a latched pixel is not sent anymore */
+		grab_left = 0;
+		grab_pixel = 0;
+	}
+}
+
+/* called from the TWI interrupt before the pixel register is transmitted */
+void optical_pixel_latch(struct optical_diag_t *output) {
+	output->pixel = grab_pixel;
+	if (grab_pixel & 1<<OPTICAL_PIXEL_VALID) {
+		grab_pixel = 0;
+		/* the grab step may have read a pixel after an abort */
+		if (grab_left) {
+			grab_left--;
+		}
+	}
+}
+#endif
+
+#if OPTICAL_MOTION_IRQ
+ISR(INT1_vect) {
+	POWER_WAKE(POWER_WAKE_OPTICAL);
+	motion = 1;
+}
+#endif
 #endif
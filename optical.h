@@ -1,4 +1,16 @@
-#include "optical_structs.h"
+#include "regmap.h"
+
+/* consumers of the motion, see optical_take() */
+#define OPTICAL_TAKE_FUSION 0
+#define OPTICAL_TAKE_TELEMETRY (USE_FUSION)
+#define OPTICAL_TAKERS (USE_FUSION + USE_TELEMETRY)
 
 void optical_init(void);
-void optical_query(struct optical_data_t *output);
+void optical_query(void);
+void optical_take(uint8_t taker, int16_t *dx, int16_t *dy);
+void optical_latch(struct optical_data_t *output, uint8_t reg);
+void optical_config_query(struct optical_config_t *output);
+void optical_set_config(uint8_t reg, uint8_t value);
+void optical_diag_query(struct optical_diag_t *output);
+void optical_frame_grab(uint8_t start);
+void optical_pixel_latch(struct optical_diag_t *output);
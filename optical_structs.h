@@ -1,4 +0,0 @@
-struct optical_data_t {
-	int8_t dx;
-	int8_t dy;
-};
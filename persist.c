@@ -0,0 +1,165 @@
+#include "config.h"
+#if USE_PERSIST
+/* warm start data in EEPROM */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "nmea.h"
+#include "persist.h"
+#include "tick.h"
+
+/* the records are written round robin to spread the wear
+ * over the entire EEPROM, 5 slots on the ATtiny2313
+ */
+#define PERSIST_SLOTS ((E2END+1) / sizeof(struct persist_record_t))
+
+/* the newest record, also the buffer while writing */
+static struct persist_record_t record;
+/* slot of the newest record, PERSIST_NONE if there is none */
+static uint8_t slot = PERSIST_NONE;
+/* position of the next byte to write, sizeof(record) when idle */
+static uint8_t write_pos = sizeof(record);
+
+static uint8_t baud = PERSIST_NONE;
+static uint8_t address = PERSIST_NONE;
+static uint16_t second_start;
+static uint16_t seconds = 0;
+/* seconds at which the fix was last saved */
+static uint16_t fix_saved;
+static uint8_t fix_saved_once = 0;
+
+static uint8_t *slot_address(uint8_t s) {
+	return (uint8_t *)(uintptr_t)(s * sizeof(struct persist_record_t));
+}
+
+/* bump whenever a field changes its meaning but not its size */
+#define PERSIST_LAYOUT 1
+
+static uint8_t record_crc(void) {
+	/* starting with the record size and layout invalidates records of
+	 * other layouts
+	 */
+	uint8_t crc = _crc_ibutton_update(sizeof(record), PERSIST_LAYOUT);
+	const uint8_t *p = (const uint8_t *)&record;
+	for (uint8_t i=0; i<offsetof(struct persist_record_t, crc); i++) {
+		crc = _crc_ibutton_update(crc, p[i]);
+	}
+	return crc;
+}
+
+/* read slot s into the record buffer; returns 1 if it holds a record */
+static uint8_t slot_read(uint8_t s) {
+	eeprom_read_block(&record, slot_address(s), sizeof(record));
+	/* erased slots read as 0xFF, which is never used as sequence number */
+	return record.seq != 0xFF && record.crc == record_crc();
+}
+
+static uint8_t next_seq(uint8_t seq) {
+	seq++;
+	return seq == 0xFF ? 0 : seq;
+}
+
+void persist_init(void) {
+	/* the newest record is the one not followed by its successor */
+	for (uint8_t s=0; s<PERSIST_SLOTS; s++) {
+		if (!slot_read(s)) {
+			continue;
+		}
+		uint8_t successor = next_seq(record.seq);
+		uint8_t n = s+1 < PERSIST_SLOTS ? s+1 : 0;
+		if (!slot_read(n) || record.seq != successor) {
+			slot = s;
+			slot_read(s);
+			break;
+		}
+	}
+	if (slot == PERSIST_NONE) {
+		memset(&record, 0, sizeof(record));
+		record.baud = PERSIST_NONE;
+		record.address = PERSIST_NONE;
+		record.optical.res = OPTICAL_RESOLUTION;
+		record.optical.mode = OPTICAL_FORCE_AWAKE<<OPTICAL_MODE_FORCE_AWAKE;
+	}
+	baud = record.baud;
+	address = record.address;
+	second_start = tick_now();
+}
+
+/* the newest record found in EEPROM, NULL if there is none */
+const struct persist_record_t *persist_last(void) {
+	return slot == PERSIST_NONE ? NULL : &record;
+}
+
+void persist_set_baud(uint32_t rate) {
+	baud = rate / PERSIST_BAUD_UNIT;
+}
+
+/* called from the TWI interrupt */
+void persist_set_address(uint8_t a) {
+	address = a;
+}
+
+static void persist_write(void) {
+	/* write one byte whenever the EEPROM is ready, the checksum last */
+	if (write_pos < sizeof(record) && eeprom_is_ready()) {
+		/* the EEPROM is busy for some milliseconds afterwards */
+		eeprom_update_byte(slot_address(slot) + write_pos,
+			((const uint8_t *)&record)[write_pos]);
+		write_pos++;
+	}
+}
+
+/* start a new record whenever the configuration changes or a fix is to be
+ * kept; called periodically, it writes the record without blocking.
+ */
+void persist_save(const struct nmea_data_t *fix, const struct optical_config_t *config) {
+	if (write_pos < sizeof(record)) {
+		persist_write();
+		return;
+	}
+	uint16_t now = tick_now();
+	if ((uint16_t)(now - second_start) < 1000) {
+		return;
+	}
+	/* decide once per second, which leaves time for the
+	 * configuration to settle after booting
+	 */
+	second_start += 1000;
+	seconds++;
+
+	uint8_t changed = baud != record.baud || address != record.address;
+	if (config && memcmp(config, &record.optical, sizeof(record.optical)) != 0) {
+		changed = 1;
+	}
+	/* the fix is only kept as aiding data */
+	uint8_t save_fix = PERSIST_AIDING && (fix->flags & 1<<NMEA_RMC_FLAGS_STATUS_OK) &&
+		(!fix_saved_once || (uint16_t)(seconds - fix_saved) >= PERSIST_FIX_INTERVAL);
+	if (!changed && !save_fix) {
+		return;
+	}
+
+	record.seq = slot == PERSIST_NONE ? 0 : next_seq(record.seq);
+	record.baud = baud;
+	record.address = address;
+	if (config) {
+		record.optical = *config;
+	}
+	if (save_fix) {
+		record.flags = fix->flags;
+		record.date = fix->date;
+		record.clock = fix->clock;
+		record.lat = fix->lat;
+		record.lon = fix->lon;
+		record.alt = fix->alt;
+		fix_saved = seconds;
+		fix_saved_once = 1;
+	}
+	record.crc = record_crc();
+	slot = slot == PERSIST_NONE || slot+1 >= PERSIST_SLOTS ? 0 : slot+1;
+	write_pos = 0;
+	persist_write();
+}
+#endif
@@ -0,0 +1,34 @@
+/* state kept in EEPROM across power cycles */
+#include "regmap.h"
+
+struct persist_record_t {
+	/* sequence number, incremented for every record written */
+	uint8_t seq;
+	/* detected GPS baud rate in units of PERSIST_BAUD_UNIT,
+	 * PERSIST_NONE if unknown
+	 */
+	uint8_t baud;
+	/* TWI address set by the master, PERSIST_NONE if unset */
+	uint8_t address;
+	/* runtime configuration of the optical sensor */
+	struct optical_config_t optical;
+	/* the last valid fix, see struct nmea_data_t */
+	uint8_t flags;
+	struct date_t date;
+	struct clock_t clock;
+	struct coord lat;
+	struct coord lon;
+	struct altitude_t alt;
+	/* checksum of the preceding bytes */
+	uint8_t crc;
+};
+
+#define PERSIST_NONE 0xFF
+/* all standard rates from 1200 to 230400 baud are multiples */
+#define PERSIST_BAUD_UNIT 1200
+
+void persist_init(void);
+const struct persist_record_t *persist_last(void);
+void persist_set_baud(uint32_t rate);
+void persist_set_address(uint8_t address);
+void persist_save(const struct nmea_data_t *fix, const struct optical_config_t *config);
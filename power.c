@@ -0,0 +1,57 @@
+#include "config.h"
+#if USE_SLEEP
+/* idle sleep between interrupts */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "power.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+volatile uint8_t power_wake = 0;
+
+void power_init(void) {
+	/* the clocks of the USI, USART and timers keep running while idle */
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/* sleep until the next interrupt unless pending() reports work;
+ * interrupts must be enabled.
+ */
+void power_idle(struct power_data_t *output, uint8_t (*pending)(void)) {
+	cli();
+	if (pending()) {
+		sei();
+		return;
+	}
+	power_wake = 0;
+	sleep_enable();
+	/* the instruction following sei is executed before any interrupt,
+	 * so we cannot miss a wake up between the check and going to sleep
+	 */
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	uint8_t wake = power_wake;
+	if (!wake) {
+		/* the USI interrupts do not record themselves */
+		wake = 1<<POWER_WAKE_TWI;
+	}
+	ATOMIC(ATOMIC_FORCEON) {
+		output->sleeps++;
+		for (uint8_t i=0; i<POWER_WAKE_SOURCES; i++) {
+			if (wake & 1<<i) {
+				output->wakes[i]++;
+			}
+		}
+	}
+}
+#endif
@@ -0,0 +1,21 @@
+#include "config.h"
+#include "regmap.h"
+
+/* sources waking the controller from sleep, up to POWER_WAKE_SOURCES */
+#define POWER_WAKE_UART 0
+#define POWER_WAKE_TICK 1
+#define POWER_WAKE_SONAR 2
+#define POWER_WAKE_OPTICAL 3
+#define POWER_WAKE_TWI 4
+#define POWER_WAKE_PPS 5
+
+#if USE_SLEEP
+extern volatile uint8_t power_wake;
+/* record the source of an interrupt that might have woken us */
+#define POWER_WAKE(src) (power_wake |= 1<<(src))
+#else
+#define POWER_WAKE(src)
+#endif
+
+void power_init(void);
+void power_idle(struct power_data_t *output, uint8_t (*pending)(void));
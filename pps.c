@@ -0,0 +1,95 @@
+#include "config.h"
+#if USE_PPS
+/* pulse per second input */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "hal.h"
+#include "nmea.h"
+#include "pps.h"
+#include "tick.h"
+#include "power.h"
+
+#if !PARSE_GPS_TIME
+	#error "USE_PPS requires PARSE_GPS_TIME"
+#endif
+
+/* beyond this, the tick counter might have wrapped around */
+#define PPS_MAX_AGE 60000
+
+static struct pps_data_t *pps_data;
+
+/* the last pulse seen */
+static volatile struct tick_stamp_t edge;
+static volatile uint8_t edge_new = 0;
+/* the pulse the published clock refers to */
+static struct tick_stamp_t paired;
+
+void pps_init(struct pps_data_t *output) {
+	pps_data = output;
+	PPS_DDR &= ~(1<<PPS_BIT);
+	PPS_PCMSK |= 1<<PPS_BIT;
+	PPS_PCICR |= 1<<PPS_PCIE;
+}
+
+/* the time elapsed since the paired pulse, in ms;
+ * must be called with interrupts disabled
+ */
+static uint16_t pps_age(uint8_t *sub) {
+	struct tick_stamp_t now;
+	tick_stamp(&now);
+	uint16_t ms = now.ms - paired.ms;
+	if (now.sub < paired.sub) {
+		now.sub += TICK_SUBS;
+		ms--;
+	}
+	if (sub) {
+		*sub = now.sub - paired.sub;
+	}
+	return ms;
+}
+
+/* a new fix has arrived, its time refers to the pulse preceding it;
+ * must be called with interrupts disabled
+ */
+void pps_pair(const struct clock_t *clock) {
+	if (!edge_new) {
+		if (pps_age(NULL) >= PPS_MAX_AGE) {
+			pps_data->flags &= ~(1<<PPS_FLAGS_VALID);
+		}
+		return;
+	}
+	edge_new = 0;
+	paired.ms = edge.ms;
+	paired.sub = edge.sub;
+	if (pps_age(NULL) >= 1000) {
+		/* the sentence belongs to a later second, a pulse is missing */
+		pps_data->flags &= ~(1<<PPS_FLAGS_VALID);
+		return;
+	}
+	pps_data->clock = *clock;
+	pps_data->flags |= 1<<PPS_FLAGS_VALID;
+}
+
+/* the master starts reading the PPS registers, called from the TWI interrupt */
+void pps_latch(void) {
+	uint8_t sub;
+	uint16_t ms = pps_age(&sub);
+	if (ms >= PPS_MAX_AGE) {
+		pps_data->flags &= ~(1<<PPS_FLAGS_VALID);
+	}
+	pps_data->offset_ms = ms;
+	pps_data->offset_sub = sub;
+}
+
+ISR(PPS_VECTOR) {
+	POWER_WAKE(POWER_WAKE_PPS);
+	if (PPS_PIN & 1<<PPS_BIT) {
+		/* rising edge, the start of a second */
+		tick_stamp((struct tick_stamp_t *)&edge);
+		edge_new = 1;
+		pps_data->pulses++;
+	}
+}
+#endif
@@ -0,0 +1,7 @@
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+void pps_init(struct pps_data_t *output);
+void pps_pair(const struct clock_t *clock);
+void pps_latch(void);
@@ -0,0 +1,64 @@
+#include "config.h"
+#if USE_PROFILER
+/* execution time measurement */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include "profile.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+static struct profile_data_t *profile_data = NULL;
+
+void profile_init(struct profile_data_t *output) {
+	profile_data = output;
+	profile_reset();
+	/* timer 1 serves as time base, clock scaling /8 */
+	TCCR1B |= 1<<CS11;
+}
+
+void profile_reset(void) {
+	ATOMIC(ATOMIC_RESTORESTATE) {
+		for (uint8_t i=0; i<PROFILE_SLOTS; i++) {
+			profile_data->slot[i].min = UINT16_MAX;
+			profile_data->slot[i].max = 0;
+			profile_data->slot[i].avg = 0;
+		}
+	}
+}
+
+uint16_t profile_now(void) {
+	uint16_t t;
+	/* reading the 16 bit register must not be interrupted,
+	 * but we are also called from interrupt handlers
+	 */
+	ATOMIC(ATOMIC_RESTORESTATE) {
+		t = TCNT1;
+	}
+	return t;
+}
+
+void profile_record(uint8_t slot, uint16_t start) {
+	uint16_t d = profile_now() - start;
+	ATOMIC(ATOMIC_RESTORESTATE) {
+		struct profile_slot_t *s = &profile_data->slot[slot];
+		if (s->max == 0) {
+			/* first run after a reset */
+			s->avg = d;
+		} else {
+			s->avg = s->avg - (s->avg>>3) + (d>>3);
+		}
+		if (d < s->min) {
+			s->min = d;
+		}
+		if (d > s->max) {
+			s->max = d;
+		}
+	}
+}
+#endif
@@ -0,0 +1,25 @@
+#include "config.h"
+#include "regmap.h"
+
+/* measured code sections */
+#define PROFILE_USI_START 0
+#define PROFILE_USI_OVERFLOW 1
+#define PROFILE_UART_RX 2
+#define PROFILE_SONAR_CAPTURE 3
+#define PROFILE_LOOP 4
+#define PROFILE_GPS 5
+/* scheduled tasks, in the order of the task table, up to PROFILE_SLOTS */
+#define PROFILE_TASK 6
+
+#if USE_PROFILER
+#define PROFILE_ENTER(v) uint16_t v = profile_now()
+#define PROFILE_LEAVE(slot, v) profile_record(slot, v)
+#else
+#define PROFILE_ENTER(v)
+#define PROFILE_LEAVE(slot, v)
+#endif
+
+void profile_init(struct profile_data_t *output);
+void profile_reset(void);
+uint16_t profile_now(void);
+void profile_record(uint8_t slot, uint16_t start);
@@ -0,0 +1,409 @@
+/* register map of the TWI interface, generated by regmap.py, do not edit */
+#ifndef REGMAP_H
+#define REGMAP_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define REGMAP_VERSION 7
+
+/* BCD digits kept of fractions of minutes */
+#define NMEA_MINUTE_FRACTS 4
+/* BCD digits kept of fractions of metres */
+#define NMEA_ALTITUDE_FRACTS 2
+/* wake up sources counted, see POWER_WAKE_* in power.h */
+#define POWER_WAKE_SOURCES 6
+/* code sections profiled, PROFILE_TASK+SCHED_MAX_TASKS */
+#define PROFILE_SLOTS 15
+/* CPU cycles per timer count of sub-ms offsets */
+#define TICK_PRESCALER 64
+/* sentence types counted */
+#define NMEA_STATS_TYPES 3
+/* index of the RMC sentence counters */
+#define NMEA_STATS_RMC 0
+/* index of the GGA sentence counters */
+#define NMEA_STATS_GGA 1
+/* index of the counters of all other sentences */
+#define NMEA_STATS_OTHER 2
+/* first byte of a telemetry frame */
+#define TELEMETRY_SYNC 165
+/* general call command latching the registers of all controllers */
+#define TWI_GCALL_LATCH 76
+
+/* bit numbers within the registers */
+#define NMEA_RMC_FLAGS_STATUS_OK 0
+#define NMEA_RMC_FLAGS_LAT_NORTH 1
+#define NMEA_RMC_FLAGS_LON_EAST 2
+#define OPTICAL_FLAGS_X_OVERFLOW 0
+#define OPTICAL_FLAGS_Y_OVERFLOW 1
+#define OPTICAL_MODE_FORCE_AWAKE 0
+#define OPTICAL_MODE_POWER_DOWN 1
+#define OPTICAL_PIXEL_VALID 7
+#define PPS_FLAGS_VALID 0
+#define FUSION_FLAGS_HEIGHT 0
+#define FUSION_FLAGS_COURSE 1
+#define FUSION_FLAGS_SATURATED 2
+#define ENU_FLAGS_VALID 0
+#define ENU_FLAGS_SATURATED 1
+#define ALARM_FLAGS_DISTANCE 0
+#define ALARM_FLAGS_APPROACH 1
+#define ALARM_FLAGS_MOTION 2
+
+#if OPTICAL_ACCU_32BIT
+typedef int32_t optical_accu_t;
+#define OPTICAL_ACCU_MAX INT32_MAX
+#define OPTICAL_ACCU_MIN INT32_MIN
+#else
+typedef int16_t optical_accu_t;
+#define OPTICAL_ACCU_MAX INT16_MAX
+#define OPTICAL_ACCU_MIN INT16_MIN
+#endif
+
+#if ENU_OFFSET_32BIT
+typedef int32_t enu_offset_t;
+#define ENU_OFFSET_MAX INT32_MAX
+#define ENU_OFFSET_MIN INT32_MIN
+#else
+typedef int16_t enu_offset_t;
+#define ENU_OFFSET_MAX INT16_MAX
+#define ENU_OFFSET_MIN INT16_MIN
+#endif
+
+struct coord {
+	/* degrees, 0-180 or 0-90 */
+	uint8_t deg;
+	/* minutes, 0-60 */
+	uint8_t min;
+	/* fractions of minutes saved as BCD */
+	uint8_t frac[(NMEA_MINUTE_FRACTS+1)/2];
+};
+
+struct altitude_t {
+	int16_t m;
+	uint8_t frac[(NMEA_ALTITUDE_FRACTS+1)/2];
+};
+
+struct clock_t {
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+};
+
+struct date_t {
+	uint8_t day;
+	uint8_t month;
+	uint8_t year;
+};
+
+struct nmea_data_t {
+	/* flag bits (lsb to msb):
+	 * 0 NMEA signal is valid (1<<NMEA_RMC_FLAGS_STATUS_OK)
+	 * 1 latitude alignment North (1<<NMEA_RMC_FLAGS_LAT_NORTH)
+	 * 2 longitude alignment East (1<<NMEA_RMC_FLAGS_LON_EAST)
+	 */
+	uint8_t flags;
+	struct date_t date;
+	struct clock_t clock;
+	struct coord lat;
+	struct coord lon;
+	struct altitude_t alt;
+	uint8_t quality;
+	uint8_t sats;
+};
+
+struct sonar_data_t {
+	/* distance in cm */
+	int16_t distance;
+};
+
+struct optical_data_t {
+	optical_accu_t dx;
+	optical_accu_t dy;
+	/* flag bits (lsb to msb):
+	 * 0 dx saturated since the last read
+	 * 1 dy saturated since the last read
+	 */
+	uint8_t flags;
+};
+
+struct optical_config_t {
+	/* resolution in steps of 125 cpi (1 to 11) */
+	uint8_t res;
+	/* mode bits (lsb to msb):
+	 * 0 forced awake, the sensor never enters its rest modes
+	 * 1 power down
+	 */
+	uint8_t mode;
+};
+
+struct optical_diag_t {
+	/* surface quality, 0 if the sensor lost track of the surface */
+	uint8_t squal;
+	/* shutter time in clock cycles */
+	uint16_t shutter;
+	uint8_t max_pixel;
+	uint8_t min_pixel;
+	/* frame grabber control:
+	 * write 1 to start grabbing a frame, 0 to abort;
+	 * reads 1 while a frame is being grabbed
+	 */
+	uint8_t frame;
+	/* next pixel of the grabbed frame, bit 7 is set if it is valid;
+	 * burst reads of this register do not advance
+	 */
+	uint8_t pixel;
+};
+
+/* progress of the output negotiation */
+struct gps_session_t {
+	/* index of the command being negotiated, GPS_SESSION_DONE when finished */
+	uint8_t state;
+	/* commands not acknowledged by the receiver, one bit per command:
+	 * 0 sentence filter (PMTK314)
+	 * 1 fix interval (PMTK220)
+	 * 2 fix interval, old firmware (PMTK300)
+	 */
+	uint8_t rejected;
+	/* number of times the receiver fell back to its defaults */
+	uint8_t restarts;
+};
+
+struct nmea_type_stats_t {
+	/* sentences completed by a line break */
+	uint16_t received;
+	/* sentences taken over, i.e. without a checksum failure */
+	uint16_t accepted;
+	uint8_t checksum_errors;
+	uint8_t no_checksum;
+	/* fields longer than the parser buffer, only their start was used */
+	uint8_t truncated;
+};
+
+/* health of the serial link to the GPS receiver, counters wrap around */
+struct nmea_stats_t {
+	/* indexed by NMEA_STATS_RMC, NMEA_STATS_GGA and NMEA_STATS_OTHER */
+	struct nmea_type_stats_t type[NMEA_STATS_TYPES];
+	/* sentences cut short by the start of the next one */
+	uint8_t aborted;
+};
+
+struct pps_data_t {
+	/* flag bits (lsb to msb):
+	 * 0 clock and offset are valid (1<<PPS_FLAGS_VALID)
+	 */
+	uint8_t flags;
+	/* UTC time of the last pulse */
+	struct clock_t clock;
+	/* time elapsed between the last pulse and the start of the read,
+	 * in ms and timer counts of 64 CPU cycles (8 µs at 8 MHz)
+	 */
+	uint16_t offset_ms;
+	uint8_t offset_sub;
+	/* number of pulses seen */
+	uint8_t pulses;
+};
+
+struct fusion_data_t {
+	/* distance travelled since the last fix in cm */
+	int16_t north;
+	int16_t east;
+	/* time since the last fix in ms, stops at 60000 */
+	uint16_t age;
+	/* 255 right after a fix, 0 when the position is not to be trusted */
+	uint8_t confidence;
+	/* flag bits (lsb to msb):
+	 * 0 the height is measured by the sonar (1<<FUSION_FLAGS_HEIGHT)
+	 * 1 the course is known (1<<FUSION_FLAGS_COURSE)
+	 * 2 an offset saturated (1<<FUSION_FLAGS_SATURATED)
+	 */
+	uint8_t flags;
+	/* incremented with every fix the offsets refer to */
+	uint8_t fixes;
+};
+
+/* reference point written by the master, in the format of the GPS registers */
+struct enu_origin_t {
+	/* NMEA_RMC_FLAGS_LAT_NORTH and NMEA_RMC_FLAGS_LON_EAST */
+	uint8_t flags;
+	struct coord lat;
+	struct coord lon;
+	/* writing the last byte activates the origin */
+	struct altitude_t alt;
+};
+
+struct enu_data_t {
+	struct enu_origin_t origin;
+	/* offsets of the last fix from the origin in cm */
+	enu_offset_t east;
+	enu_offset_t north;
+	enu_offset_t up;
+	/* flag bits (lsb to msb):
+	 * 0 origin and fix are valid (1<<ENU_FLAGS_VALID)
+	 * 1 an offset saturated (1<<ENU_FLAGS_SATURATED)
+	 */
+	uint8_t flags;
+};
+
+struct alarm_sample_t {
+	/* in cm */
+	uint16_t distance;
+	/* rate of approach in cm/s */
+	uint16_t approach;
+	/* optical counts per second, x and y added up */
+	uint16_t motion;
+};
+
+struct alarm_data_t {
+	/* thresholds, 0 disables a comparator:
+	 * alarm below the distance, above the approach and the motion;
+	 * writing the second byte of a threshold activates it
+	 */
+	struct alarm_sample_t limit;
+	/* comparators tripped since the last clear (lsb to msb):
+	 * 0 distance (1<<ALARM_FLAGS_DISTANCE)
+	 * 1 rate of approach (1<<ALARM_FLAGS_APPROACH)
+	 * 2 optical motion (1<<ALARM_FLAGS_MOTION)
+	 * write any value to clear them and release the alarm output
+	 */
+	uint8_t flags;
+	/* flags of the comparators that latched the sample */
+	uint8_t first;
+	/* measurements that raised the alarm;
+	 * the motion reads 0 after a sonar alarm, distance and approach
+	 * read 0 after a motion alarm
+	 */
+	struct alarm_sample_t sample;
+};
+
+struct power_data_t {
+	/* number of times the controller went to sleep */
+	uint16_t sleeps;
+	/* wake ups per source, indexed by POWER_WAKE_* */
+	uint16_t wakes[POWER_WAKE_SOURCES];
+};
+
+/* durations are measured in timer ticks of 8 CPU cycles */
+struct profile_slot_t {
+	uint16_t min;
+	uint16_t max;
+	/* moving average over roughly the last 8 runs */
+	uint16_t avg;
+};
+
+struct profile_data_t {
+	/* write any value to reset the statistics */
+	uint8_t reset;
+	struct profile_slot_t slot[PROFILE_SLOTS];
+};
+
+struct twi_diag_t {
+	/* times the TWI slave released a stuck bus, wraps around */
+	uint16_t recoveries;
+};
+
+struct bus_data_t {
+#if USE_TWI_ADDRESS_SET
+	/* 7 bit TWI address in use; write the new address followed by its complement
+	 * to change it after the transfer, 0 returns to the address set at build time
+	 */
+	uint8_t address;
+#endif
+#if USE_TWI_ADDRESS_SET
+	uint8_t confirm;
+#endif
+#if TWI_GENERAL_CALL
+	/* number of TWI_GCALL_LATCH commands received, wraps around */
+	uint8_t latches;
+#endif
+#if TWI_GENERAL_CALL
+	/* system tick of the last latch, in ms and timer counts of 64 CPU cycles */
+	uint16_t latch_ms;
+#endif
+#if TWI_GENERAL_CALL
+	uint8_t latch_sub;
+#endif
+};
+
+/* data the master sends to the GPS receiver, e.g. RTCM corrections */
+struct gps_forward_t {
+	/* bytes the FIFO can take */
+	uint8_t free;
+	/* bytes forwarded to the receiver, wraps around */
+	uint16_t sent;
+	/* bytes written here, and beyond in the same transfer, are forwarded in order;
+	 * a byte the FIFO cannot take is not acknowledged
+	 */
+	uint8_t data;
+};
+
+/* streamed on the UART, framed by TELEMETRY_SYNC, REGMAP_VERSION and
+ * the record size, followed by a CRC-CCITT (see telemetry.c)
+ */
+struct telemetry_record_t {
+	/* incremented with every record, gaps are records dropped for lack of bandwidth */
+	uint8_t seq;
+	/* system tick of the sample in ms */
+	uint16_t time;
+	struct nmea_data_t gps;
+#if USE_SONAR
+	/* sonar distance in cm */
+	int16_t distance;
+#endif
+#if USE_OPTICAL
+	/* optical motion since the previous record */
+	int16_t dx;
+#endif
+#if USE_OPTICAL
+	int16_t dy;
+#endif
+};
+
+/* the register window read and written over TWI */
+struct nav_data_t {
+	/* layout revision, see regmap.py */
+	uint8_t version;
+	struct nmea_data_t gps;
+	struct sonar_data_t sonar;
+	struct optical_data_t optical;
+#if USE_OPTICAL
+	struct optical_config_t optical_config;
+#endif
+#if USE_OPTICAL && USE_OPTICAL_DIAG
+	struct optical_diag_t optical_diag;
+#endif
+#if USE_GPS && GPS_NEGOTIATE
+	struct gps_session_t gps_session;
+#endif
+#if USE_GPS && USE_NMEA_STATS
+	struct nmea_stats_t nmea_stats;
+#endif
+#if USE_PPS
+	struct pps_data_t pps;
+#endif
+#if USE_FUSION
+	struct fusion_data_t fusion;
+#endif
+#if USE_ENU
+	struct enu_data_t enu;
+#endif
+#if USE_ALARM
+	struct alarm_data_t alarm;
+#endif
+#if USE_SLEEP
+	struct power_data_t power;
+#endif
+#if USE_PROFILER
+	struct profile_data_t profile;
+#endif
+#if USE_TWI_WATCHDOG
+	struct twi_diag_t twi;
+#endif
+#if USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+	struct bus_data_t bus;
+#endif
+#if USE_GPS && USE_GPS_FORWARD
+	struct gps_forward_t forward;
+#endif
+};
+
+#endif
@@ -0,0 +1,560 @@
+#!/usr/bin/env python3
+"""Register map of the tiny-gps TWI interface.
+
+This is the single description of the wire format: the firmware structs in
+regmap.h, the decoder header for the I2C master and the byte table are all
+generated from it. Bump VERSION whenever the layout changes.
+
+    regmap.py --firmware > regmap.h
+    regmap.py --master [--config config.h] [--f-cpu 8000000] > tiny-gps-regs.h
+    regmap.py --table [--config config.h]
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# layout revision, readable at offset 0 of the register window
+VERSION = 7
+
+# sizes not depending on config.h
+CONSTANTS = [
+    ('NMEA_MINUTE_FRACTS', 4, 'BCD digits kept of fractions of minutes'),
+    ('NMEA_ALTITUDE_FRACTS', 2, 'BCD digits kept of fractions of metres'),
+    ('POWER_WAKE_SOURCES', 6, 'wake up sources counted, see POWER_WAKE_* in power.h'),
+    ('PROFILE_SLOTS', 15, 'code sections profiled, PROFILE_TASK+SCHED_MAX_TASKS'),
+    ('TICK_PRESCALER', 64, 'CPU cycles per timer count of sub-ms offsets'),
+    ('NMEA_STATS_TYPES', 3, 'sentence types counted'),
+    ('NMEA_STATS_RMC', 0, 'index of the RMC sentence counters'),
+    ('NMEA_STATS_GGA', 1, 'index of the GGA sentence counters'),
+    ('NMEA_STATS_OTHER', 2, 'index of the counters of all other sentences'),
+    ('TELEMETRY_SYNC', 0xA5, 'first byte of a telemetry frame'),
+    ('TWI_GCALL_LATCH', 0x4C, 'general call command latching the registers '
+     'of all controllers'),
+]
+
+# bit numbers within the registers
+BITS = [
+    ('NMEA_RMC_FLAGS_STATUS_OK', 0),
+    ('NMEA_RMC_FLAGS_LAT_NORTH', 1),
+    ('NMEA_RMC_FLAGS_LON_EAST', 2),
+    ('OPTICAL_FLAGS_X_OVERFLOW', 0),
+    ('OPTICAL_FLAGS_Y_OVERFLOW', 1),
+    ('OPTICAL_MODE_FORCE_AWAKE', 0),
+    ('OPTICAL_MODE_POWER_DOWN', 1),
+    ('OPTICAL_PIXEL_VALID', 7),
+    ('PPS_FLAGS_VALID', 0),
+    ('FUSION_FLAGS_HEIGHT', 0),
+    ('FUSION_FLAGS_COURSE', 1),
+    ('FUSION_FLAGS_SATURATED', 2),
+    ('ENU_FLAGS_VALID', 0),
+    ('ENU_FLAGS_SATURATED', 1),
+    ('ALARM_FLAGS_DISTANCE', 0),
+    ('ALARM_FLAGS_APPROACH', 1),
+    ('ALARM_FLAGS_MOTION', 2),
+]
+
+# integer types
+TYPES = {
+    'uint8_t': 1, 'int8_t': 1,
+    'uint16_t': 2, 'int16_t': 2,
+    'uint32_t': 4, 'int32_t': 4,
+}
+
+
+class Typedef(object):
+    """integer type whose width is selected by a config.h option"""
+
+    def __init__(self, name, option, wide, narrow, limits):
+        self.name = name
+        self.option = option
+        self.wide = wide
+        self.narrow = narrow
+        self.limits = limits
+
+    def ctype(self, config):
+        return self.wide if config.get(self.option, 0) else self.narrow
+
+
+class Field(object):
+    """member of a struct: an integer, a nested struct or an array of either
+
+    count may be an expression of CONSTANTS, cond a config.h expression;
+    trap marks registers whose reads have side effects in the firmware
+    """
+
+    def __init__(self, type, name, doc=None, count=None, cond=None,
+                 trap=False):
+        self.type = type
+        self.name = name
+        self.doc = doc
+        self.count = count
+        self.cond = cond
+        self.trap = trap
+
+
+class Struct(object):
+    def __init__(self, name, fields, doc=None):
+        self.name = name
+        self.fields = fields
+        self.doc = doc
+
+
+TYPEDEFS = [
+    Typedef('optical_accu_t', 'OPTICAL_ACCU_32BIT', 'int32_t', 'int16_t',
+            'OPTICAL_ACCU'),
+    Typedef('enu_offset_t', 'ENU_OFFSET_32BIT', 'int32_t', 'int16_t',
+            'ENU_OFFSET'),
+]
+
+STRUCTS = [
+    Struct('coord', [
+        Field('uint8_t', 'deg', 'degrees, 0-180 or 0-90'),
+        Field('uint8_t', 'min', 'minutes, 0-60'),
+        Field('uint8_t', 'frac', 'fractions of minutes saved as BCD',
+              count='(NMEA_MINUTE_FRACTS+1)/2'),
+    ]),
+    Struct('altitude_t', [
+        Field('int16_t', 'm'),
+        Field('uint8_t', 'frac', count='(NMEA_ALTITUDE_FRACTS+1)/2'),
+    ]),
+    Struct('clock_t', [
+        Field('uint8_t', 'hour'),
+        Field('uint8_t', 'minute'),
+        Field('uint8_t', 'second'),
+    ]),
+    Struct('date_t', [
+        Field('uint8_t', 'day'),
+        Field('uint8_t', 'month'),
+        Field('uint8_t', 'year'),
+    ]),
+    Struct('nmea_data_t', [
+        Field('uint8_t', 'flags', 'flag bits (lsb to msb):\n'
+              '0 NMEA signal is valid (1<<NMEA_RMC_FLAGS_STATUS_OK)\n'
+              '1 latitude alignment North (1<<NMEA_RMC_FLAGS_LAT_NORTH)\n'
+              '2 longitude alignment East (1<<NMEA_RMC_FLAGS_LON_EAST)'),
+        Field('date_t', 'date'),
+        Field('clock_t', 'clock'),
+        Field('coord', 'lat'),
+        Field('coord', 'lon'),
+        Field('altitude_t', 'alt'),
+        Field('uint8_t', 'quality'),
+        Field('uint8_t', 'sats'),
+    ]),
+    Struct('sonar_data_t', [
+        Field('int16_t', 'distance', 'distance in cm'),
+    ]),
+    Struct('optical_data_t', [
+        Field('optical_accu_t', 'dx'),
+        Field('optical_accu_t', 'dy'),
+        Field('uint8_t', 'flags', 'flag bits (lsb to msb):\n'
+              '0 dx saturated since the last read\n'
+              '1 dy saturated since the last read'),
+    ]),
+    Struct('optical_config_t', [
+        Field('uint8_t', 'res', 'resolution in steps of 125 cpi (1 to 11)'),
+        Field('uint8_t', 'mode', 'mode bits (lsb to msb):\n'
+              '0 forced awake, the sensor never enters its rest modes\n'
+              '1 power down'),
+    ]),
+    Struct('optical_diag_t', [
+        Field('uint8_t', 'squal',
+              'surface quality, 0 if the sensor lost track of the surface'),
+        Field('uint16_t', 'shutter', 'shutter time in clock cycles'),
+        Field('uint8_t', 'max_pixel'),
+        Field('uint8_t', 'min_pixel'),
+        Field('uint8_t', 'frame', 'frame grabber control:\n'
+              'write 1 to start grabbing a frame, 0 to abort;\n'
+              'reads 1 while a frame is being grabbed'),
+        Field('uint8_t', 'pixel',
+              'next pixel of the grabbed frame, bit 7 is set if it is valid;\n'
+              'burst reads of this register do not advance'),
+    ]),
+    Struct('gps_session_t', [
+        Field('uint8_t', 'state', 'index of the command being negotiated, '
+              'GPS_SESSION_DONE when finished'),
+        Field('uint8_t', 'rejected',
+              'commands not acknowledged by the receiver, one bit per command:\n'
+              '0 sentence filter (PMTK314)\n'
+              '1 fix interval (PMTK220)\n'
+              '2 fix interval, old firmware (PMTK300)'),
+        Field('uint8_t', 'restarts',
+              'number of times the receiver fell back to its defaults'),
+    ], 'progress of the output negotiation'),
+    Struct('nmea_type_stats_t', [
+        Field('uint16_t', 'received', 'sentences completed by a line break'),
+        Field('uint16_t', 'accepted', 'sentences taken over, '
+              'i.e. without a checksum failure'),
+        Field('uint8_t', 'checksum_errors'),
+        Field('uint8_t', 'no_checksum'),
+        Field('uint8_t', 'truncated', 'fields longer than the parser buffer, '
+              'only their start was used'),
+    ]),
+    Struct('nmea_stats_t', [
+        Field('nmea_type_stats_t', 'type', 'indexed by NMEA_STATS_RMC, '
+              'NMEA_STATS_GGA and NMEA_STATS_OTHER', count='NMEA_STATS_TYPES'),
+        Field('uint8_t', 'aborted',
+              'sentences cut short by the start of the next one'),
+    ], 'health of the serial link to the GPS receiver, counters wrap around'),
+    Struct('pps_data_t', [
+        Field('uint8_t', 'flags', 'flag bits (lsb to msb):\n'
+              '0 clock and offset are valid (1<<PPS_FLAGS_VALID)'),
+        Field('clock_t', 'clock', 'UTC time of the last pulse'),
+        Field('uint16_t', 'offset_ms',
+              'time elapsed between the last pulse and the start of the read,\n'
+              'in ms and timer counts of 64 CPU cycles (8 µs at 8 MHz)'),
+        Field('uint8_t', 'offset_sub'),
+        Field('uint8_t', 'pulses', 'number of pulses seen'),
+    ]),
+    Struct('fusion_data_t', [
+        Field('int16_t', 'north', 'distance travelled since the last fix in cm'),
+        Field('int16_t', 'east'),
+        Field('uint16_t', 'age', 'time since the last fix in ms, stops at 60000'),
+        Field('uint8_t', 'confidence', '255 right after a fix, '
+              '0 when the position is not to be trusted'),
+        Field('uint8_t', 'flags', 'flag bits (lsb to msb):\n'
+              '0 the height is measured by the sonar (1<<FUSION_FLAGS_HEIGHT)\n'
+              '1 the course is known (1<<FUSION_FLAGS_COURSE)\n'
+              '2 an offset saturated (1<<FUSION_FLAGS_SATURATED)'),
+        Field('uint8_t', 'fixes',
+              'incremented with every fix the offsets refer to'),
+    ]),
+    Struct('enu_origin_t', [
+        Field('uint8_t', 'flags',
+              'NMEA_RMC_FLAGS_LAT_NORTH and NMEA_RMC_FLAGS_LON_EAST'),
+        Field('coord', 'lat'),
+        Field('coord', 'lon'),
+        Field('altitude_t', 'alt', 'writing the last byte activates the origin'),
+    ], 'reference point written by the master, in the format of the GPS registers'),
+    Struct('enu_data_t', [
+        Field('enu_origin_t', 'origin'),
+        Field('enu_offset_t', 'east',
+              'offsets of the last fix from the origin in cm'),
+        Field('enu_offset_t', 'north'),
+        Field('enu_offset_t', 'up'),
+        Field('uint8_t', 'flags', 'flag bits (lsb to msb):\n'
+              '0 origin and fix are valid (1<<ENU_FLAGS_VALID)\n'
+              '1 an offset saturated (1<<ENU_FLAGS_SATURATED)'),
+    ]),
+    Struct('alarm_sample_t', [
+        Field('uint16_t', 'distance', 'in cm'),
+        Field('uint16_t', 'approach', 'rate of approach in cm/s'),
+        Field('uint16_t', 'motion', 'optical counts per second, x and y added up'),
+    ]),
+    Struct('alarm_data_t', [
+        Field('alarm_sample_t', 'limit', 'thresholds, 0 disables a comparator:\n'
+              'alarm below the distance, above the approach and the motion;\n'
+              'writing the second byte of a threshold activates it'),
+        Field('uint8_t', 'flags', 'comparators tripped since the last clear '
+              '(lsb to msb):\n'
+              '0 distance (1<<ALARM_FLAGS_DISTANCE)\n'
+              '1 rate of approach (1<<ALARM_FLAGS_APPROACH)\n'
+              '2 optical motion (1<<ALARM_FLAGS_MOTION)\n'
+              'write any value to clear them and release the alarm output'),
+        Field('uint8_t', 'first', 'flags of the comparators that latched the sample'),
+        Field('alarm_sample_t', 'sample', 'measurements that raised the alarm;\n'
+              'the motion reads 0 after a sonar alarm, distance and approach\n'
+              'read 0 after a motion alarm'),
+    ]),
+    Struct('power_data_t', [
+        Field('uint16_t', 'sleeps',
+              'number of times the controller went to sleep'),
+        Field('uint16_t', 'wakes', 'wake ups per source, indexed by POWER_WAKE_*',
+              count='POWER_WAKE_SOURCES'),
+    ]),
+    Struct('profile_slot_t', [
+        Field('uint16_t', 'min'),
+        Field('uint16_t', 'max'),
+        Field('uint16_t', 'avg',
+              'moving average over roughly the last 8 runs'),
+    ], 'durations are measured in timer ticks of 8 CPU cycles'),
+    Struct('profile_data_t', [
+        Field('uint8_t', 'reset', 'write any value to reset the statistics'),
+        Field('profile_slot_t', 'slot', count='PROFILE_SLOTS'),
+    ]),
+    Struct('twi_diag_t', [
+        Field('uint16_t', 'recoveries', 'times the TWI slave released a stuck '
+              'bus, wraps around'),
+    ]),
+    Struct('bus_data_t', [
+        Field('uint8_t', 'address', '7 bit TWI address in use; write the new '
+              'address followed by its complement\n'
+              'to change it after the transfer, 0 returns to the address '
+              'set at build time', cond='USE_TWI_ADDRESS_SET'),
+        Field('uint8_t', 'confirm', cond='USE_TWI_ADDRESS_SET'),
+        Field('uint8_t', 'latches', 'number of TWI_GCALL_LATCH commands '
+              'received, wraps around', cond='TWI_GENERAL_CALL'),
+        Field('uint16_t', 'latch_ms', 'system tick of the last latch, '
+              'in ms and timer counts of 64 CPU cycles', cond='TWI_GENERAL_CALL'),
+        Field('uint8_t', 'latch_sub', cond='TWI_GENERAL_CALL'),
+    ]),
+    Struct('gps_forward_t', [
+        Field('uint8_t', 'free', 'bytes the FIFO can take'),
+        Field('uint16_t', 'sent', 'bytes forwarded to the receiver, wraps around'),
+        Field('uint8_t', 'data', 'bytes written here, and beyond in the same '
+              'transfer, are forwarded in order;\n'
+              'a byte the FIFO cannot take is not acknowledged'),
+    ], 'data the master sends to the GPS receiver, e.g. RTCM corrections'),
+    Struct('telemetry_record_t', [
+        Field('uint8_t', 'seq', 'incremented with every record, '
+              'gaps are records dropped for lack of bandwidth'),
+        Field('uint16_t', 'time', 'system tick of the sample in ms'),
+        Field('nmea_data_t', 'gps'),
+        Field('int16_t', 'distance', 'sonar distance in cm', cond='USE_SONAR'),
+        Field('int16_t', 'dx', 'optical motion since the previous record',
+              cond='USE_OPTICAL'),
+        Field('int16_t', 'dy', cond='USE_OPTICAL'),
+    ], 'streamed on the UART, framed by TELEMETRY_SYNC, REGMAP_VERSION and\n'
+       'the record size, followed by a CRC-CCITT (see telemetry.c)'),
+    Struct('nav_data_t', [
+        Field('uint8_t', 'version', 'layout revision, see regmap.py'),
+        Field('nmea_data_t', 'gps'),
+        Field('sonar_data_t', 'sonar'),
+        Field('optical_data_t', 'optical', trap=True),
+        Field('optical_config_t', 'optical_config', cond='USE_OPTICAL'),
+        Field('optical_diag_t', 'optical_diag',
+              cond='USE_OPTICAL && USE_OPTICAL_DIAG', trap=True),
+        Field('gps_session_t', 'gps_session', cond='USE_GPS && GPS_NEGOTIATE'),
+        Field('nmea_stats_t', 'nmea_stats', cond='USE_GPS && USE_NMEA_STATS'),
+        Field('pps_data_t', 'pps', cond='USE_PPS', trap=True),
+        Field('fusion_data_t', 'fusion', cond='USE_FUSION'),
+        Field('enu_data_t', 'enu', cond='USE_ENU'),
+        Field('alarm_data_t', 'alarm', cond='USE_ALARM'),
+        Field('power_data_t', 'power', cond='USE_SLEEP'),
+        Field('profile_data_t', 'profile', cond='USE_PROFILER'),
+        Field('twi_diag_t', 'twi', cond='USE_TWI_WATCHDOG'),
+        Field('bus_data_t', 'bus', cond='USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL'),
+        # writes past the end of the window go to the FIFO, keep it last
+        Field('gps_forward_t', 'forward', cond='USE_GPS && USE_GPS_FORWARD'),
+    ], 'the register window read and written over TWI'),
+]
+
+
+def read_config(path):
+    config = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'#define\s+(\w+)\s+(\d+)\s*$', line)
+            if m:
+                config[m.group(1)] = int(m.group(2))
+    return config
+
+
+def evaluate(expr, names):
+    """value of a C integer expression of known macros"""
+    py = expr.replace('&&', ' and ').replace('||', ' or ')
+    py = re.sub(r'!(?!=)', ' not ', py)
+    py = re.sub(r'\b[A-Za-z_]\w*\b',
+                lambda m: m.group(0) if m.group(0) in ('and', 'or', 'not')
+                else str(names.get(m.group(0), 0)), py)
+    # C division truncates, all operands are positive
+    return int(eval(py, {'__builtins__': {}}))
+
+
+def count(field):
+    if field.count is None:
+        return None
+    return evaluate(field.count, dict((n, v) for n, v, _ in CONSTANTS))
+
+
+def structs():
+    return dict((s.name, s) for s in STRUCTS)
+
+
+class Layout(object):
+    """offsets and sizes of the registers for a configuration"""
+
+    def __init__(self, config):
+        self.config = config
+        self.types = dict(TYPES)
+        for t in TYPEDEFS:
+            self.types[t.name] = TYPES[t.ctype(config)]
+        self.sizes = {}
+        for s in STRUCTS:
+            self.sizes[s.name] = sum(self.size(f) for f in self.fields(s))
+        self.size_total = self.sizes['nav_data_t']
+
+    def fields(self, struct):
+        return [f for f in struct.fields
+                if f.cond is None or evaluate(f.cond, self.config)]
+
+    def size(self, field):
+        size = self.types.get(field.type) or self.sizes[field.type]
+        return size * (count(field) or 1)
+
+    def offsets(self, name='nav_data_t', base=0, prefix=''):
+        """(path, offset, type, count, field) of every member, depth first"""
+        offset = base
+        for f in self.fields(structs()[name]):
+            path = prefix + f.name
+            yield path, offset, f
+            if f.type in self.sizes and not f.count:
+                for sub in self.offsets(f.type, offset, path + '.'):
+                    yield sub
+            offset += self.size(f)
+
+    def offset(self, path):
+        for p, offset, f in self.offsets():
+            if p == path:
+                return offset
+        raise KeyError(path)
+
+
+def comment(doc, indent):
+    lines = doc.split('\n')
+    if len(lines) == 1:
+        return '%s/* %s */\n' % (indent, doc)
+    out = '%s/* %s\n' % (indent, lines[0])
+    for line in lines[1:]:
+        out += '%s * %s\n' % (indent, line)
+    return out + '%s */\n' % indent
+
+
+def member(field, ctype, indent='\t'):
+    out = comment(field.doc, indent) if field.doc else ''
+    n = '[%s]' % field.count if field.count else ''
+    return out + '%s%s %s%s;\n' % (indent, ctype, field.name, n)
+
+
+def firmware():
+    """structs of the firmware, options are left to the preprocessor"""
+    out = ('/* register map of the TWI interface, generated by regmap.py, '
+           'do not edit */\n'
+           '#ifndef REGMAP_H\n#define REGMAP_H\n\n'
+           '#include <stdint.h>\n#include "config.h"\n\n'
+           '#define REGMAP_VERSION %d\n\n' % VERSION)
+    typedefs = [t.name for t in TYPEDEFS]
+    for name, value, doc in CONSTANTS:
+        out += '/* %s */\n#define %s %d\n' % (doc, name, value)
+    out += '\n/* bit numbers within the registers */\n'
+    for name, bit in BITS:
+        out += '#define %s %d\n' % (name, bit)
+    for t in TYPEDEFS:
+        out += '\n#if %s\n' % t.option
+        for ctype in (t.wide, t.narrow):
+            bits = ctype[3:-2] if ctype.startswith('int') else ctype[4:-2]
+            out += ('typedef %s %s;\n#define %s_MAX INT%s_MAX\n'
+                    '#define %s_MIN INT%s_MIN\n'
+                    % (ctype, t.name, t.limits, bits, t.limits, bits))
+            if ctype == t.wide:
+                out += '#else\n'
+        out += '#endif\n'
+    for s in STRUCTS:
+        out += '\n'
+        if s.doc:
+            out += comment(s.doc, '')
+        out += 'struct %s {\n' % s.name
+        for f in s.fields:
+            if f.cond:
+                out += '#if %s\n' % f.cond
+            ctype = f.type if f.type in TYPES or f.type in typedefs \
+                else 'struct ' + f.type
+            out += member(f, ctype)
+            if f.cond:
+                out += '#endif\n'
+        out += '};\n'
+    return out + '\n#endif\n'
+
+
+def master(config, source, f_cpu):
+    """packed structs for the master, overlaying a burst read from offset 0"""
+    layout = Layout(config)
+    typedefs = dict((t.name, t.ctype(config)) for t in TYPEDEFS)
+    out = ('/* tiny-gps register map, generated by regmap.py from %s, '
+           'do not edit */\n'
+           '#ifndef TINYGPS_REGS_H\n#define TINYGPS_REGS_H\n\n'
+           '#include <stddef.h>\n#include <stdint.h>\n\n'
+           '#if defined(__BYTE_ORDER__) && '
+           '__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n'
+           '#error "the registers are little endian"\n#endif\n\n'
+           '#ifdef __cplusplus\n#define TINYGPS_ASSERT static_assert\n'
+           '#else\n#define TINYGPS_ASSERT _Static_assert\n#endif\n\n'
+           '#define TINYGPS_VERSION %d\n#define TINYGPS_SIZE %d\n'
+           '#define TINYGPS_F_CPU %dUL\n'
+           % (source, VERSION, layout.size_total, f_cpu))
+    for f in structs()['nav_data_t'].fields:
+        if f.cond:
+            out += '#define TINYGPS_HAS_%s %d\n' % (
+                f.name.upper(), evaluate(f.cond, config))
+    for name, value, doc in CONSTANTS:
+        out += '#define TINYGPS_%s %d\n' % (name, value)
+    for name, bit in BITS:
+        out += '#define TINYGPS_%s %d\n' % (name, bit)
+    out += ('\n/* the banks present, in order: X(ID, member, reads have side '
+            'effects) */\n#define TINYGPS_BANKS(X)')
+    for f in layout.fields(structs()['nav_data_t']):
+        out += ' \\\n\tX(%s, %s, %d)' % (f.name.upper(), f.name, f.trap)
+    out += '\n'
+    for s in STRUCTS:
+        out += '\n'
+        if s.doc:
+            out += comment(s.doc, '')
+        out += 'struct tinygps_%s {\n' % re.sub(r'_t$', '', s.name)
+        for f in layout.fields(s):
+            if f.type in TYPES:
+                ctype = f.type
+            elif f.type in typedefs:
+                ctype = typedefs[f.type]
+            else:
+                ctype = 'struct tinygps_' + re.sub(r'_t$', '', f.type)
+            f = Field(f.type, f.name, f.doc, count(f))
+            out += member(f, ctype)
+        out += '} __attribute__((packed));\n'
+    out += '\n'
+    for path, offset, f in layout.offsets():
+        if '.' not in path:
+            out += ('TINYGPS_ASSERT(offsetof(struct tinygps_nav_data, %s) == %d, '
+                    '"layout");\n' % (path, offset))
+    out += ('TINYGPS_ASSERT(sizeof(struct tinygps_nav_data) == TINYGPS_SIZE, '
+            '"layout");\n\n'
+            '/* the registers in a buffer read starting at offset 0, NULL if it\n'
+            ' * is too short or was written by another firmware revision\n'
+            ' */\n'
+            'static inline const struct tinygps_nav_data *\n'
+            'tinygps_decode(const void *buf, size_t len)\n{\n'
+            '\tconst struct tinygps_nav_data *regs =\n'
+            '\t\t(const struct tinygps_nav_data *)buf;\n'
+            '\tif (len < sizeof(*regs) || regs->version != TINYGPS_VERSION) {\n'
+            '\t\treturn NULL;\n\t}\n\treturn regs;\n}\n\n#endif\n')
+    return out
+
+
+def table(config):
+    layout = Layout(config)
+    out = 'byte\tsize\tregister\n'
+    for path, offset, f in layout.offsets():
+        if f.type in layout.sizes and not f.count:
+            continue
+        out += '%d\t%d\t%s\n' % (offset, layout.size(f), path)
+    return out
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    mode = p.add_mutually_exclusive_group(required=True)
+    mode.add_argument('--firmware', action='store_true',
+                      help='structs of the firmware (regmap.h)')
+    mode.add_argument('--master', action='store_true',
+                      help='decoder header for the I2C master')
+    mode.add_argument('--table', action='store_true',
+                      help='offsets of all registers')
+    p.add_argument('--config', default=None,
+                   help='config.h the firmware is built with')
+    p.add_argument('--f-cpu', type=int, default=8000000,
+                   help='F_CPU the firmware is built with')
+    args = p.parse_args()
+
+    path = args.config or os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), 'config.h')
+    if args.firmware:
+        sys.stdout.write(firmware())
+    elif args.master:
+        sys.stdout.write(master(read_config(path), os.path.basename(path),
+                                args.f_cpu))
+    else:
+        sys.stdout.write(table(read_config(path)))
+
+
+if __name__ == '__main__':
+    main()
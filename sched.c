@@ -0,0 +1,71 @@
+/* cooperative deadline scheduler */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "sched.h"
+#include "tick.h"
+#include "profile.h"
+
+#if PROFILE_TASK + SCHED_MAX_TASKS > PROFILE_SLOTS
+	#error "PROFILE_SLOTS in regmap.py has no room for every task"
+#endif
+
+/* task table, stored in flash */
+static const struct sched_task_t *sched_tasks = NULL;
+static uint8_t sched_n = 0;
+/* time each task becomes due */
+static uint16_t *sched_due = NULL;
+
+void sched_init(const struct sched_task_t *tasks, uint16_t *due, uint8_t n) {
+	if (n > SCHED_MAX_TASKS) {
+		/* the tasks beyond have no profile slot */
+		n = SCHED_MAX_TASKS;
+	}
+	sched_tasks = tasks;
+	sched_due = due;
+	sched_n = n;
+	uint16_t now = tick_now();
+	for (uint8_t i=0; i<n; i++) {
+		sched_due[i] = now;
+	}
+}
+
+/* run the due task with the earliest deadline, skipping tasks below
+ * min_prio; returns 0 if no task was run.
+ */
+uint8_t sched_step(uint8_t min_prio) {
+	uint16_t now = tick_now();
+	uint8_t next = SCHED_MAX_TASKS;
+	uint16_t next_deadline = 0;
+	for (uint8_t i=0; i<sched_n; i++) {
+		const struct sched_task_t *t = &sched_tasks[i];
+		if ((int16_t)(now - sched_due[i]) < 0) {
+			/* not yet due */
+			continue;
+		}
+		if (pgm_read_byte(&t->prio) < min_prio) {
+			/* shed the task for now, it will be late */
+			continue;
+		}
+		uint16_t deadline = sched_due[i] + pgm_read_word(&t->deadline);
+		if (next == SCHED_MAX_TASKS || (int16_t)(deadline - next_deadline) < 0) {
+			next = i;
+			next_deadline = deadline;
+		}
+	}
+	if (next == SCHED_MAX_TASKS) {
+		return 0;
+	}
+	const struct sched_task_t *t = &sched_tasks[next];
+	uint16_t period = pgm_read_word(&t->period);
+	sched_due[next] += period;
+	if ((int16_t)(now - sched_due[next]) >= 0) {
+		/* we fell behind, do not try to catch up */
+		sched_due[next] = now + period;
+	}
+	void (*run)(void) = (void (*)(void))pgm_read_word(&t->run);
+	PROFILE_ENTER(start);
+	run();
+	PROFILE_LEAVE(PROFILE_TASK+next, start);
+	return 1;
+}
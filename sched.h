@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include "config.h"
+
+/* maximum number of tasks handled by the scheduler, each one has a
+ * profile slot
+ */
+#define SCHED_MAX_TASKS 9
+
+struct sched_task_t {
+	void (*run)(void);
+	/* the task is due every period ms, 0 makes it due on every pass */
+	uint16_t period;
+	/* the task should run within deadline ms after becoming due;
+	 * among all due tasks, the one with the earliest deadline runs first
+	 */
+	uint16_t deadline;
+	/* tasks below the priority passed to sched_step() are shed */
+	uint8_t prio;
+};
+
+/* due holds the time each of the n tasks becomes due, it is provided by
+ * the caller so it is sized by the task table
+ */
+void sched_init(const struct sched_task_t *tasks, uint16_t *due, uint8_t n);
+uint8_t sched_step(uint8_t min_prio);
@@ -7,11 +7,11 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <string.h>
+#include "hal.h"
 #include "sonar.h"
-
-#define SONAR_TRIGGER_PORT PORTD
-#define SONAR_TRIGGER_DDR DDRD
-#define SONAR_TRIGGER_BIT PD2
+#include "power.h"
+#include "profile.h"
+#include "alarm.h"
 
 #if __AVR__
 #include <util/atomic.h>
@@ -26,6 +26,9 @@ static volatile int16_t sonar_pong[SONAR_AVG_WINDOW_SIZE] = {-1};
 	#error "SONAR_AVG_WINDOW_SIZE has to be >= 1"
 #endif
 
+/* timer value at the rising edge of the echo */
+static volatile uint16_t sonar_echo_start = 0;
+
 static volatile enum {
 	SONAR_READY,
 	SONAR_PING,
@@ -43,10 +46,13 @@ void sonar_init(void) {
 
 	/* - clock scaling /8 (yielding ticks of 0,000001s)
 	 * - input capture on rising edge
+	 *
+	 * The timer is running freely, so it can also serve as a time base
+	 * for other purposes.
 	 */
 	TCCR1B = 1<<CS11 | 1<<ICES1;
-	/* enable capture interrupt */
-	TIMSK = (1<<ICIE1 | 1<<TOIE1);
+	/* enable capture and timeout interrupts */
+	CAPTURE_TIMSK |= (1<<ICIE1 | 1<<OCIE1A);
 }
 
 uint8_t sonar_ready(void) {
@@ -57,7 +63,9 @@ void sonar_ping(void) {
 	ATOMIC(ATOMIC_FORCEON) {
 		sonar_state = SONAR_PING;
 		SONAR_TRIGGER_PORT |= 1<<SONAR_TRIGGER_BIT;
-		TCNT1 = 0;
+		/* time out once the timer wrapped around */
+		OCR1A = TCNT1;
+		CAPTURE_TIFR = 1<<OCF1A;
 	}
 	_delay_us(10);
 	SONAR_TRIGGER_PORT &= ~(1<<SONAR_TRIGGER_BIT);
@@ -99,25 +107,35 @@ int16_t sonar_last_pong(void) {
 }
 
 ISR(TIMER1_CAPT_vect) {
+	PROFILE_ENTER(start);
+	POWER_WAKE(POWER_WAKE_SONAR);
 	if (sonar_state == SONAR_PING) {
-		// reset timer
-		TCNT1 = 0;
+		sonar_echo_start = ICR1;
 		// now we wait for the falling edge
 		sonar_state = SONAR_PONG;
 	} else if (sonar_state == SONAR_PONG) {
-		sonar_pong[sonar_pong_i] = ICR1;
+		uint16_t echo = ICR1 - sonar_echo_start;
+		sonar_pong[sonar_pong_i] = echo;
+#if USE_ALARM
+		alarm_echo(echo);
+#endif
 #if SONAR_AVG_WINDOW_SIZE > 1
 		sonar_pong_i++;
 		if (sonar_pong_i == SONAR_AVG_WINDOW_SIZE) sonar_pong_i = 0;
 #endif
 	}
 	TCCR1B ^= (1<<ICES1);
+	PROFILE_LEAVE(PROFILE_SONAR_CAPTURE, start);
 }
 
-ISR(TIMER1_OVF_vect) {
+ISR(TIMER1_COMPA_vect) {
+	POWER_WAKE(POWER_WAKE_SONAR);
 	if (sonar_state == SONAR_PING) {
 		// we are still waiting for a reply? Impossible!
 		sonar_pong[sonar_pong_i] = -1;
+#if USE_ALARM
+		alarm_echo_lost();
+#endif
 #if SONAR_AVG_WINDOW_SIZE > 1
 		sonar_pong_i++;
 		if (sonar_pong_i == SONAR_AVG_WINDOW_SIZE) sonar_pong_i = 0;
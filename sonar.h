@@ -1,4 +1,4 @@
-#include "sonar_structs.h"
+#include "regmap.h"
 
 void sonar_init(void);
 uint8_t sonar_ready(void);
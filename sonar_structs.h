@@ -1,3 +0,0 @@
-struct sonar_data_t {
-	int16_t distance;
-};
@@ -0,0 +1,129 @@
+#include "config.h"
+#if USE_TELEMETRY
+/* framed binary records on the UART transmitter
+ *
+ * frame: TELEMETRY_SYNC, REGMAP_VERSION, record size, record and the
+ * CRC-CCITT (initial value 0xFFFF) of version, size and record, least
+ * significant byte first
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include "hal.h"
+#include "tick.h"
+#include "power.h"
+#include "optical.h"
+#include "telemetry.h"
+
+#if GPS_NEGOTIATE
+	#error "USE_TELEMETRY takes over the UART transmitter needed by GPS_NEGOTIATE"
+#endif
+#if GPS_AUTOBAUD
+	#error "USE_TELEMETRY is sent at GPS_BAUD, the logger cannot follow GPS_AUTOBAUD"
+#endif
+#if HAL_TWI_USI
+	#error "USE_TELEMETRY needs the SRAM of an ATmega part for the transmit buffer"
+#endif
+
+#define FRAME_SIZE (3 + sizeof(struct telemetry_record_t) + 2)
+
+#define TX_BUF_SIZE HAL_TX_BUF_SIZE
+static volatile uint8_t tx_buf[TX_BUF_SIZE];
+static volatile uint8_t tx_buf_r = 0;
+static volatile uint8_t tx_buf_w = 0;
+
+static uint8_t seq = 0;
+
+void telemetry_init(void) {
+#if !USE_GPS
+	/* nobody else set up the UART */
+	#define BAUD GPS_BAUD
+	#include <util/setbaud.h>
+	UCSRA = (USE_2X<<U2X);
+	UBRRL = UBRRL_VALUE;
+	UCSRC = (3<<UCSZ0);
+#endif
+	/* the receiver has been initialized, the transmitter is ours */
+	UCSRB |= 1<<TXEN;
+}
+
+static uint8_t tx_free(void) {
+	/* one byte stays free to tell a full buffer from an empty one */
+	uint8_t r = tx_buf_r;
+	if (r <= tx_buf_w) {
+		r += TX_BUF_SIZE;
+	}
+	return r - tx_buf_w - 1;
+}
+
+static void tx_put(uint8_t c) {
+	tx_buf[tx_buf_w] = c;
+	tx_buf_w = tx_buf_w + 1 < TX_BUF_SIZE ? tx_buf_w + 1 : 0;
+}
+
+/* the checksummed part of the frame */
+static uint16_t crc;
+
+static void tx_put_field(const void *field, uint8_t size) {
+	const uint8_t *p = field;
+	while (size--) {
+		crc = _crc_ccitt_update(crc, *p);
+		tx_put(*p++);
+	}
+}
+
+/* the record is put into the buffer field by field, so all fields of
+ * telemetry_record_t have to be sent below, in their order
+ */
+_Static_assert(sizeof(struct telemetry_record_t) == 3 + sizeof(struct nmea_data_t)
+#if USE_SONAR
+	+ 2
+#endif
+#if USE_OPTICAL
+	+ 4
+#endif
+	, "telemetry_send() does not match telemetry_record_t");
+
+/* queue a record of the current data, unless the last ones are still
+ * being sent
+ */
+void telemetry_send(const struct nav_data_t *data) {
+	uint8_t n = seq++;
+	if (tx_free() < FRAME_SIZE) {
+		return;
+	}
+	uint16_t time = tick_now();
+
+	tx_put(TELEMETRY_SYNC);
+	crc = 0xFFFF;
+	uint8_t header[] = { REGMAP_VERSION, sizeof(struct telemetry_record_t) };
+	tx_put_field(header, sizeof(header));
+	tx_put_field(&n, sizeof(n));
+	tx_put_field(&time, sizeof(time));
+	tx_put_field(&data->gps, sizeof(data->gps));
+#if USE_SONAR
+	tx_put_field(&data->sonar.distance, sizeof(data->sonar.distance));
+#endif
+#if USE_OPTICAL
+	int16_t d[2];
+	optical_take(OPTICAL_TAKE_TELEMETRY, &d[0], &d[1]);
+	tx_put_field(d, sizeof(d));
+#endif
+	tx_put(crc & 0xFF);
+	tx_put(crc >> 8);
+	/* the interrupt drains the buffer */
+	UCSRB |= 1<<UDRIE;
+}
+
+ISR(USART_UDRE_vect) {
+	POWER_WAKE(POWER_WAKE_UART);
+	if (tx_buf_r == tx_buf_w) {
+		UCSRB &= ~(1<<UDRIE);
+		return;
+	}
+	UDR = tx_buf[tx_buf_r];
+	tx_buf_r = tx_buf_r + 1 < TX_BUF_SIZE ? tx_buf_r + 1 : 0;
+}
+#endif
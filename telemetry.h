@@ -0,0 +1,7 @@
+/* framed binary records on the UART transmitter */
+#include <stdint.h>
+#include "config.h"
+#include "regmap.h"
+
+void telemetry_init(void);
+void telemetry_send(const struct nav_data_t *data);
@@ -0,0 +1,61 @@
+/* system tick, counting milliseconds */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "hal.h"
+#include "tick.h"
+#include "power.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+#if TICK_PRESCALER != 64
+	#error "the timer clock scaling below has to match TICK_PRESCALER"
+#endif
+#if TICK_SUBS > 256
+	#error "F_CPU is too high for the system tick"
+#endif
+
+static volatile uint16_t tick = 0;
+
+void tick_init(void) {
+	/* - clear timer on compare match
+	 * - clock scaling /64
+	 */
+	TCCR0A = 1<<WGM01;
+	TCCR0B = 1<<CS01 | 1<<CS00;
+	OCR0A = TICK_SUBS - 1;
+	/* enable compare interrupt */
+	TICK_TIMSK |= 1<<OCIE0A;
+}
+
+uint16_t tick_now(void) {
+	uint16_t t;
+	ATOMIC(ATOMIC_FORCEON) {
+		t = tick;
+	}
+	return t;
+}
+
+/* the current time including the timer count;
+ * must be called with interrupts disabled
+ */
+void tick_stamp(struct tick_stamp_t *t) {
+	t->ms = tick;
+	t->sub = TCNT0;
+	if (TICK_TIFR & 1<<OCF0A) {
+		/* the timer has wrapped, but the tick has not been counted yet */
+		t->ms++;
+		t->sub = TCNT0;
+	}
+}
+
+ISR(TIMER0_COMPA_vect) {
+	POWER_WAKE(POWER_WAKE_TICK);
+	tick++;
+}
@@ -0,0 +1,15 @@
+#include <stdint.h>
+#include "regmap.h"
+#define TICK_HZ 1000
+/* timer counts per tick, TICK_PRESCALER CPU cycles each */
+#define TICK_SUBS (F_CPU/TICK_PRESCALER/TICK_HZ)
+
+/* a point in time with the resolution of the timer */
+struct tick_stamp_t {
+	uint16_t ms;
+	uint8_t sub;
+};
+
+void tick_init(void);
+uint16_t tick_now(void);
+void tick_stamp(struct tick_stamp_t *t);
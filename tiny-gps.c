@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
@@ -6,144 +7,473 @@
 #include <string.h>
 
 #include "nmea.h"
+#include "gps.h"
 #include "sonar.h"
 #include "optical.h"
-#include "nav_structs.h"
-#include "usiTwiSlave.h"
+#include "tick.h"
+#include "sched.h"
+#include "power.h"
+#include "profile.h"
+#include "persist.h"
+#include "pps.h"
+#include "fusion.h"
+#include "enu.h"
+#include "alarm.h"
+#include "telemetry.h"
+#include "bus.h"
+#include "regmap.h"
+#include "hal.h"
 
 #include "config.h"
 
 
 #if USE_GPS
-#define RX_BUF_SIZE 4
+#define RX_BUF_SIZE HAL_RX_BUF_SIZE
 static volatile char rx_buf[RX_BUF_SIZE];
 static volatile uint8_t rx_buf_r = 0;
 static volatile uint8_t rx_buf_w = 0;
 #endif
 
-struct nav_data_t nav_data = {{0}};
+struct nav_data_t nav_data = {REGMAP_VERSION};
 
+#define USE_TWI_TRAP (USE_OPTICAL || USE_PPS)
+
+/* the first register that needs to be prepared for reading */
 #if USE_OPTICAL
-static void window_trap(void) {
-	/* did we read the last byte of the data? then reset the counters! */
-	memset(&nav_data.optical, 0, sizeof(nav_data.optical));
+#define TRAP_FIRST offsetof(struct nav_data_t, optical)
+#else
+#define TRAP_FIRST offsetof(struct nav_data_t, pps)
+#endif
+
+#if TWI_GENERAL_CALL && USE_TWI_TRAP
+/* registers latched by a general call, the next read takes them as they are */
+static uint8_t latched = 0;
+#define LATCHED_OPTICAL_DX 0
+#define LATCHED_OPTICAL_DY 1
+#define LATCHED_PPS 2
+
+static uint8_t was_latched(uint8_t bit) {
+	uint8_t l = latched & 1<<bit;
+	latched &= ~(1<<bit);
+	return l;
 }
-#define TRAP_ADDR &window_trap
 #else
-#define TRAP_ADDR NULL
+#define was_latched(bit) 0
+#endif
+
+#if USE_TWI_TRAP
+static void window_trap(uint8_t offset) {
+#if USE_OPTICAL
+	if (offset == offsetof(struct nav_data_t, optical.dx)) {
+		/* the master is reading the optical registers, latch and clear them */
+		if (!was_latched(LATCHED_OPTICAL_DX)) {
+			optical_latch(&nav_data.optical, offsetof(struct optical_data_t, dx));
+		}
+	} else if (offset == offsetof(struct nav_data_t, optical.dy)) {
+		if (!was_latched(LATCHED_OPTICAL_DY)) {
+			optical_latch(&nav_data.optical, offsetof(struct optical_data_t, dy));
+		}
+	}
+#if USE_OPTICAL_DIAG
+	else if (offset == offsetof(struct nav_data_t, optical_diag.pixel)) {
+		/* hand out the next pixel of the grabbed frame */
+		optical_pixel_latch(&nav_data.optical_diag);
+	}
+#endif
+#endif
+#if USE_PPS
+	if (offset == offsetof(struct nav_data_t, pps)) {
+		/* the master starts reading the PPS registers, take the time */
+		if (!was_latched(LATCHED_PPS)) {
+			pps_latch();
+		}
+	}
+#endif
+}
+#endif
+
+#if TWI_GENERAL_CALL
+static void general_call(uint8_t command) {
+	/* a command to all controllers on the bus */
+	if (command != TWI_GCALL_LATCH) {
+		return;
+	}
+#if USE_OPTICAL
+	optical_latch(&nav_data.optical, offsetof(struct optical_data_t, dx));
+	optical_latch(&nav_data.optical, offsetof(struct optical_data_t, dy));
+	latched |= 1<<LATCHED_OPTICAL_DX | 1<<LATCHED_OPTICAL_DY;
+#endif
+#if USE_PPS
+	pps_latch();
+	latched |= 1<<LATCHED_PPS;
+#endif
+	bus_latched();
+}
+#endif
+
+#define USE_TWI_RECEIVER (USE_OPTICAL || USE_PROFILER || USE_ENU || USE_ALARM || USE_GPS_FORWARD || USE_TWI_ADDRESS_SET)
+
+#if USE_TWI_RECEIVER
+static void window_receive(uint8_t offset, uint8_t data) {
+	/* the master wrote to a register */
+#if USE_OPTICAL
+	if (offset >= offsetof(struct nav_data_t, optical_config) &&
+	    offset < offsetof(struct nav_data_t, optical_config) + sizeof(nav_data.optical_config)) {
+		optical_set_config(offset - offsetof(struct nav_data_t, optical_config), data);
+	}
+#endif
+#if USE_OPTICAL && USE_OPTICAL_DIAG
+	if (offset == offsetof(struct nav_data_t, optical_diag.frame)) {
+		optical_frame_grab(data);
+	}
+#endif
+#if USE_ENU
+	if (offset >= offsetof(struct nav_data_t, enu.origin) &&
+	    offset < offsetof(struct nav_data_t, enu.origin) + sizeof(nav_data.enu.origin)) {
+		enu_set_origin(offset - offsetof(struct nav_data_t, enu.origin), data);
+	}
+#endif
+#if USE_ALARM
+	if (offset >= offsetof(struct nav_data_t, alarm) &&
+	    offset < offsetof(struct nav_data_t, alarm) + sizeof(nav_data.alarm)) {
+		alarm_set(offset - offsetof(struct nav_data_t, alarm), data);
+	}
+#endif
+#if USE_PROFILER
+	if (offset == offsetof(struct nav_data_t, profile.reset)) {
+		profile_reset();
+	}
+#endif
+#if USE_TWI_ADDRESS_SET
+	if (offset == offsetof(struct nav_data_t, bus.address) ||
+	    offset == offsetof(struct nav_data_t, bus.confirm)) {
+		bus_set(offset - offsetof(struct nav_data_t, bus), data);
+	}
+#endif
+#if USE_GPS_FORWARD
+	if (offset >= offsetof(struct nav_data_t, forward.data)) {
+		gps_forward_put(data);
+	}
+#endif
+}
+#endif
+
+#if USE_GPS_FORWARD
+static uint8_t window_ready(uint8_t offset) {
+	/* may the master write to this register? */
+	return offset < offsetof(struct nav_data_t, forward.data) || gps_forward_free();
+}
 #endif
 
 #if USE_GPS
-static void init_gps_unit(void) {
-	/* enable RX pin and interrupt */
-	UCSRB = ( 1<<RXEN | 1<<RXCIE
-#ifdef GPS_INIT_STRING
-	/* also enable the TX pin */
-	| 1<<TXEN
-#endif
-	);
-
-	UCSRC = (0<<USBS)|(3<<UCSZ0);
-
-#ifdef GPS_INIT_BAUD
-	/* set initial baud rate for initialization */
-	#define BAUD GPS_INIT_BAUD
-	#include <util/setbaud.h>
-	UCSRA = (USE_2X<<U2X);
-	UBRRL = UBRRL_VALUE;
-	#undef BAUD
-#endif
-
-#ifdef GPS_INIT_STRING
-#ifdef GPS_INIT_DELAY
-	_delay_ms(GPS_INIT_DELAY);
-#endif
-	/* transmit configuration commands */
-	PGM_P init = PSTR(GPS_INIT_STRING);
-	const char *p = init;
-	char c;
-	while ((c = pgm_read_byte(p++)) != '\0') {
-		UDR = c;
-		/* wait for transmission to complete */
-		while(!(UCSRA & (1<<UDRE)));
-#ifdef GPS_INIT_LINEFEED_DELAY
-		if (c == '\n') {
-			_delay_ms(GPS_INIT_LINEFEED_DELAY);
+static void gps_drain(void) {
+	/* read from the serial UART */
+	while (rx_buf_w != rx_buf_r) {
+		nmea_process_character(rx_buf[rx_buf_r]);
+		rx_buf_r++;
+		if (rx_buf_r >= RX_BUF_SIZE) {
+			rx_buf_r = 0;
 		}
+	}
+}
+
+static uint8_t gps_backlog(void) {
+	/* number of characters waiting in the receive buffer */
+	uint8_t w = rx_buf_w;
+	if (w < rx_buf_r) {
+		w += RX_BUF_SIZE;
+	}
+	return w - rx_buf_r;
+}
+#endif
+
+#if NMEA_FIX_HANDLER
+static void fix_received(uint8_t position) {
+#if USE_PPS
+	pps_pair(&nav_data.gps.clock);
+#endif
+#if USE_FUSION
+	if (position && nav_data.gps.flags & 1<<NMEA_RMC_FLAGS_STATUS_OK) {
+		fusion_anchor();
+	}
+#endif
+#if USE_ENU
+	if (position) {
+		enu_fix();
+	}
 #endif
+	(void)position;
+}
+#endif
+
+#if LED_FIX_INDICATOR
+static void led_task(void) {
+	/* toggle gps fix indicator */
+	if (nav_data.gps.flags & 1<<NMEA_RMC_FLAGS_STATUS_OK) {
+		LED_PORT |= (1<<LED_BIT);
+	} else {
+		LED_PORT &= ~(1<<LED_BIT);
 	}
+}
 #endif
 
-	/* now set final baud rate */
-	#define BAUD GPS_BAUD
-	#include <util/setbaud.h>
-	UCSRA = (USE_2X<<U2X);
-	UBRRL = UBRRL_VALUE;
+#if USE_SONAR
+static void sonar_task(void) {
+	nav_data.sonar.distance = sonar_last_pong();
+	if (sonar_ready()) {
+		sonar_ping();
+	}
+}
+#endif
+
+#if USE_OPTICAL
+static void optical_task(void) {
+	optical_config_query(&nav_data.optical_config);
+	optical_query();
+#if USE_OPTICAL_DIAG
+	optical_diag_query(&nav_data.optical_diag);
+#endif
+}
+#endif
+
+#if USE_FUSION
+static void fusion_task(void) {
+#if USE_SONAR
+	fusion_update(nav_data.sonar.distance);
+#else
+	fusion_update(-1);
+#endif
+}
+#endif
+
+#if USE_ENU
+static void enu_task(void) {
+	enu_update(&nav_data.gps);
+}
+#endif
+
+#if USE_ALARM
+static void alarm_task(void) {
+	alarm_update();
+}
+#endif
+
+#if USE_TELEMETRY
+static void telemetry_task(void) {
+	telemetry_send(&nav_data);
+}
+#endif
+
+#if USE_PERSIST
+static void persist_task(void) {
+#if USE_OPTICAL
+	persist_save(&nav_data.gps, &nav_data.optical_config);
+#else
+	persist_save(&nav_data.gps, NULL);
+#endif
+}
+#endif
+
+#if USE_TWI_WATCHDOG
+static void twi_watchdog_task(void) {
+	nav_data.twi.recoveries += twiSlaveWatchdog();
+}
+#endif
+
+/* tasks at or above this priority are not shed */
+#define PRIO_KEEP 1
+
+/* the UART is drained between any two tasks, so the latency of GPS
+ * processing is bounded by the longest running task.
+ */
+static const struct sched_task_t tasks[] PROGMEM = {
+#if USE_GPS && GPS_NEGOTIATE
+	/* feed the UART once per tick while a command is being sent */
+	{ &gps_session_task, 1, 10, 0 },
+#endif
+#if USE_SONAR
+	{ &sonar_task, SONAR_PERIOD, SONAR_PERIOD, 2 },
+#endif
+#if LED_FIX_INDICATOR
+	{ &led_task, 100, 100, 1 },
+#endif
+#if USE_OPTICAL
+#if OPTICAL_MAX_RATE
+	{ &optical_task, TICK_HZ/OPTICAL_MAX_RATE, TICK_HZ/OPTICAL_MAX_RATE, 0 },
+#elif OPTICAL_MOTION_IRQ
+	/* check the motion flag once per tick, so we can sleep in between */
+	{ &optical_task, 1, 5, 0 },
+#else
+	{ &optical_task, 0, 5, 0 },
+#endif
+#endif
+#if USE_FUSION
+	{ &fusion_task, FUSION_PERIOD, FUSION_PERIOD, 1 },
+#endif
+#if USE_ENU
+	{ &enu_task, 10, 50, 1 },
+#endif
+#if USE_ALARM
+	{ &alarm_task, 10, 50, 1 },
+#endif
+#if USE_TELEMETRY
+	{ &telemetry_task, TICK_HZ/TELEMETRY_RATE, TICK_HZ/TELEMETRY_RATE, 0 },
+#endif
+#if USE_TWI_WATCHDOG
+	/* a stuck bus blocks every other device on it */
+	{ &twi_watchdog_task, TWI_STUCK_TIMEOUT, TWI_STUCK_TIMEOUT, PRIO_KEEP },
+#endif
+#if USE_PERSIST
+	/* an EEPROM byte takes about 3.4 ms to write */
+	{ &persist_task, 4, 100, 0 },
+#endif
+};
+
+#define TASK_COUNT (sizeof(tasks)/sizeof(tasks[0]))
+/* every task has its own profile slot */
+_Static_assert(TASK_COUNT <= SCHED_MAX_TASKS, "too many tasks, raise SCHED_MAX_TASKS");
+/* time each task becomes due */
+static uint16_t task_due[TASK_COUNT];
+
+#if USE_SLEEP
+static uint8_t work_pending(void) {
+#if USE_GPS
+	return rx_buf_w != rx_buf_r;
+#else
+	return 0;
+#endif
 }
 #endif
 
 int main(void) {
+	tick_init();
+#if USE_PERSIST
+	persist_init();
+#endif
 #if USE_GPS
-	init_gps_unit();
 	nmea_init(&nav_data.gps);
+#if USE_NMEA_STATS
+	nmea_stats_init(&nav_data.nmea_stats);
+#endif
+	gps_init();
+#if USE_GPS_FORWARD
+	gps_forward_init(&nav_data.forward);
+#endif
+#if GPS_NEGOTIATE
+	gps_session_init(&nav_data.gps_session);
+#endif
+#endif
+
+#if USE_TELEMETRY
+	telemetry_init();
 #endif
 
 #if USE_SONAR
 	sonar_init();
 #endif
+#if USE_PROFILER
+	profile_init(&nav_data.profile);
+#endif
+#if USE_PPS
+	pps_init(&nav_data.pps);
+#endif
+#if USE_FUSION
+	fusion_init(&nav_data.fusion);
+#endif
+#if USE_ENU
+	enu_init(&nav_data.enu);
+#endif
+#if USE_ALARM
+	alarm_init(&nav_data.alarm);
+#endif
 #if USE_OPTICAL
 	optical_init();
+#if USE_PERSIST
+	/* restore the configuration set at runtime */
+	if (persist_last()) {
+		for (uint8_t i=0; i<sizeof(struct optical_config_t); i++) {
+			optical_set_config(i, ((const uint8_t *)&persist_last()->optical)[i]);
+		}
+	}
+#endif
 #endif
 
-	usiTwiSlaveInit(TWIADDRESS);
-	usiTwiSetTransmitWindow( &nav_data, sizeof(nav_data) );
-#if USE_OPTICAL
-	usiTwiSlaveSetTrap(TRAP_ADDR);
+#if TWI_ADDRESS_STRAPS || USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+	twiSlaveInit(bus_address());
+#else
+	twiSlaveInit(TWIADDRESS);
+#endif
+#if USE_TWI_ADDRESS_SET || TWI_GENERAL_CALL
+	bus_init(&nav_data.bus);
+#endif
+	twiSlaveSetTransmitWindow(&nav_data, sizeof(nav_data));
+#if USE_TWI_TRAP
+	twiSlaveSetTrap(&window_trap, TRAP_FIRST);
+#endif
+#if USE_TWI_RECEIVER
+	twiSlaveSetReceiver(&window_receive);
+#endif
+#if USE_GPS_FORWARD
+	twiSlaveSetFlowControl(&window_ready);
+#endif
+#if TWI_GENERAL_CALL
+	twiSlaveSetGeneralCall(&general_call);
+#endif
+#if USE_OPTICAL && USE_OPTICAL_DIAG
+	twiSlaveSetStream(offsetof(struct nav_data_t, optical_diag.pixel));
 #endif
 
 #if LED_FIX_INDICATOR
-	DDRD = (1<<PD5);
-	PORTD &= ~(1<<PD5);
+	LED_DDR |= (1<<LED_BIT);
+	LED_PORT &= ~(1<<LED_BIT);
+#endif
+
+#if USE_GPS && NMEA_FIX_HANDLER
+	/* everything the handler touches is set up now */
+	nmea_set_fix_handler(&fix_received);
+#endif
+
+	sched_init(tasks, task_due, TASK_COUNT);
+#if USE_SLEEP
+	power_init();
 #endif
 
 	sei();
 	while (1) {
+		uint8_t busy;
+		PROFILE_ENTER(loop_start);
 #if USE_GPS
-		/* read from the serial UART */
-		while (rx_buf_w != rx_buf_r) {
-			nmea_process_character(rx_buf[rx_buf_r]);
-			rx_buf_r++;
-			if (rx_buf_r >= RX_BUF_SIZE) {
-				rx_buf_r = 0;
-			}
-		}
+		/* characters that piled up during the last task mean the
+		 * receiver outpaces us, measured before draining them
+		 */
+		uint8_t min_prio = gps_backlog() >= SCHED_SHED_WATERMARK ? PRIO_KEEP : 0;
+		PROFILE_ENTER(gps_start);
+		gps_drain();
+		PROFILE_LEAVE(PROFILE_GPS, gps_start);
+		busy = sched_step(min_prio);
+#else
+		busy = sched_step(0);
 #endif
-		/* toggle gps fix indicator */
-#if LED_FIX_INDICATOR
-		if (nav_data.gps.flags & 1<<NMEA_RMC_FLAGS_STATUS_OK) {
-			PORTD |= (1<<PD5);
-		} else {
-			PORTD &= ~(1<<PD5);
+		PROFILE_LEAVE(PROFILE_LOOP, loop_start);
+#if USE_SLEEP
+		if (!busy) {
+			power_idle(&nav_data.power, &work_pending);
 		}
-#endif
-#if USE_SONAR
-		nav_data.sonar.distance = sonar_last_pong();
-		if (sonar_ready()) {
-			sonar_ping();
-		}
-#endif
-#if USE_OPTICAL
-		optical_query(&nav_data.optical);
+#else
+		(void)busy;
 #endif
 	}
 }
 
 #if USE_GPS
 ISR(USART_RX_vect) {
+	PROFILE_ENTER(start);
+	POWER_WAKE(POWER_WAKE_UART);
 	rx_buf[rx_buf_w] = UDR;
 	rx_buf_w++;
 	if (rx_buf_w >= RX_BUF_SIZE) {
 		rx_buf_w = 0;
 	}
+	PROFILE_LEAVE(PROFILE_UART_RX, start);
 }
 #endif
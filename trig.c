@@ -0,0 +1,49 @@
+#include "config.h"
+#if USE_FUSION || USE_ENU
+/* table based trigonometry */
+#include <stdlib.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "trig.h"
+
+/* sin(x)*TRIG_ONE for x = 0..90 degrees */
+static const uint16_t sine[91] PROGMEM = {
+	0, 572, 1144, 1715, 2286, 2856, 3425, 3993,
+	4560, 5126, 5690, 6252, 6813, 7371, 7927, 8481,
+	9032, 9580, 10126, 10668, 11207, 11743, 12275, 12803,
+	13328, 13848, 14364, 14876, 15383, 15886, 16383, 16876,
+	17364, 17846, 18323, 18794, 19260, 19720, 20173, 20621,
+	21062, 21497, 21925, 22347, 22762, 23170, 23571, 23964,
+	24351, 24730, 25101, 25465, 25821, 26169, 26509, 26841,
+	27165, 27481, 27788, 28087, 28377, 28659, 28932, 29196,
+	29451, 29697, 29934, 30162, 30381, 30591, 30791, 30982,
+	31163, 31335, 31498, 31650, 31794, 31927, 32051, 32165,
+	32269, 32364, 32448, 32523, 32587, 32642, 32687, 32722,
+	32747, 32762, 32767,
+};
+
+/* sine of any whole angle in degrees */
+int16_t trig_sin(uint16_t deg) {
+	deg %= 360;
+	if (deg <= 90) {
+		return pgm_read_word(&sine[deg]);
+	} else if (deg <= 180) {
+		return pgm_read_word(&sine[180-deg]);
+	} else if (deg <= 270) {
+		return -pgm_read_word(&sine[deg-180]);
+	}
+	return -pgm_read_word(&sine[360-deg]);
+}
+
+/* cosine of an angle between 0 and 90 degrees, interpolated
+ * between the degrees by the minutes
+ */
+int16_t trig_cos(uint8_t deg, uint8_t min) {
+	if (deg >= 90) {
+		return 0;
+	}
+	int16_t c0 = pgm_read_word(&sine[90-deg]);
+	int16_t c1 = pgm_read_word(&sine[89-deg]);
+	return c0 - (int16_t)((int32_t)(c0 - c1) * min / 60);
+}
+#endif
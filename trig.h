@@ -0,0 +1,8 @@
+#include <stdint.h>
+#include "config.h"
+
+/* 1.0 in the fixed point results */
+#define TRIG_ONE 32767
+
+int16_t trig_sin(uint16_t deg);
+int16_t trig_cos(uint8_t deg, uint8_t min);
@@ -0,0 +1,217 @@
+#include "config.h"
+#include "hal.h"
+#if !HAL_TWI_USI
+/* TWI slave on the hardware TWI peripheral
+ *
+ * Works like the USI driver: the first byte written by the master sets
+ * the offset into the transmit window, following bytes are handed to the
+ * receiver; reads start at the offset set before, or at 0.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+#include "profile.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
+
+static uint8_t *window;
+static uint8_t window_size = 0;
+static uint8_t window_offset = 0;
+static uint8_t stream_offset = 0xFF;
+static bool offset_pending;
+
+static void (*window_trap)(uint8_t) = NULL;
+static uint8_t window_trap_offset;
+static void (*window_receiver)(uint8_t, uint8_t) = NULL;
+static uint8_t (*window_ready)(uint8_t) = NULL;
+static void (*general_call)(uint8_t) = NULL;
+
+#if USE_TWI_WATCHDOG
+/* the peripheral takes part in a transfer */
+static volatile bool busy = false;
+/* incremented by every interrupt, the watchdog looks for a standstill */
+static volatile uint8_t activity;
+static uint8_t activity_seen;
+#endif
+
+/* acknowledge the next byte and release the bus */
+#define TWI_ACK  (1<<TWINT | 1<<TWEA | 1<<TWEN | 1<<TWIE)
+/* do not acknowledge the next byte */
+#define TWI_NACK (1<<TWINT | 1<<TWEN | 1<<TWIE)
+
+void twiSlaveInit(uint8_t address) {
+	/* general calls are answered once there is a handler */
+	TWAR = address<<1;
+	TWCR = TWI_ACK;
+}
+
+/* the address byte of an ongoing transfer has been answered already */
+void twiSlaveSetAddress(uint8_t address) {
+	TWAR = address<<1 | (TWAR & 1<<TWGCE);
+}
+
+/* command() is called with every byte written to address 0 */
+void twiSlaveSetGeneralCall(void (*command)(uint8_t data)) {
+	general_call = command;
+	if (command) {
+		TWAR |= 1<<TWGCE;
+	} else {
+		TWAR &= ~(1<<TWGCE);
+	}
+}
+
+void twiSlaveSetTrap(void (*trap)(uint8_t offset), uint8_t first) {
+	window_trap = trap;
+	window_trap_offset = first;
+}
+
+void twiSlaveSetReceiver(void (*receiver)(uint8_t offset, uint8_t data)) {
+	window_receiver = receiver;
+}
+
+/* ready() is asked before the byte for offset is acknowledged, which
+ * happens right after the preceding byte here
+ */
+void twiSlaveSetFlowControl(uint8_t (*ready)(uint8_t offset)) {
+	window_ready = ready;
+}
+
+#if USE_TWI_WATCHDOG
+/* call every TWI_STUCK_TIMEOUT ms: a transfer that saw no interrupt since
+ * the last call and has SDA or SCL low is abandoned by resetting the
+ * peripheral, which releases the lines; returns 1 if it did so
+ */
+uint8_t twiSlaveWatchdog(void) {
+	uint8_t stuck = 0;
+	ATOMIC(ATOMIC_FORCEON) {
+		if (busy && activity == activity_seen &&
+		    (TWI_PIN & (1<<TWI_SDA_BIT | 1<<TWI_SCL_BIT)) != (1<<TWI_SDA_BIT | 1<<TWI_SCL_BIT)) {
+			TWCR = 0;
+			TWCR = TWI_ACK;
+			busy = false;
+			stuck = 1;
+		}
+		activity_seen = activity;
+	}
+	return stuck;
+}
+#endif
+
+void twiSlaveSetStream(uint8_t offset) {
+	stream_offset = offset;
+}
+
+void twiSlaveSetTransmitWindow(void *start, size_t size) {
+	window = start;
+	window_size = size;
+}
+
+static void twiSlaveTransmit(void) {
+	uint8_t offset = window_offset;
+	if (offset >= window_size) {
+		/* beyond the window, the master reads garbage */
+		TWDR = 0xFF;
+		return;
+	}
+	if (window_trap && offset >= window_trap_offset) {
+		window_trap(offset);
+	}
+	TWDR = window[offset];
+	if (offset != stream_offset) {
+		window_offset++;
+	}
+}
+
+ISR(TWI_vect) {
+	PROFILE_ENTER(start);
+	uint8_t control = TWI_ACK;
+#if USE_TWI_WATCHDOG
+	activity++;
+	/* until one of the states ending a transfer below */
+	busy = true;
+#endif
+	switch (TW_STATUS) {
+		case TW_SR_SLA_ACK:
+		case TW_SR_ARB_LOST_SLA_ACK:
+			/* the master writes, the first byte is the offset */
+			offset_pending = true;
+			break;
+		case TW_SR_GCALL_ACK:
+		case TW_SR_ARB_LOST_GCALL_ACK:
+			/* the first byte is the command */
+			offset_pending = true;
+			break;
+		case TW_SR_GCALL_DATA_ACK:
+			/* general calls carry commands, they never touch the window;
+			 * the bytes following the command are its parameters
+			 */
+			if (offset_pending && general_call) {
+				general_call(TWDR);
+			}
+			offset_pending = false;
+			break;
+		case TW_SR_DATA_ACK:
+			if (offset_pending) {
+				window_offset = TWDR;
+				offset_pending = false;
+			} else {
+				if (window_receiver) {
+					window_receiver(window_offset, TWDR);
+				}
+				if (window_offset != stream_offset) {
+					window_offset++;
+				}
+			}
+			if (window_ready && !window_ready(window_offset)) {
+				/* refuse the next byte */
+				control = TWI_NACK;
+			}
+			break;
+		case TW_SR_DATA_NACK:
+		case TW_SR_GCALL_DATA_NACK:
+			/* a refused byte, listen to our address again */
+#if USE_TWI_WATCHDOG
+			busy = false;
+#endif
+			break;
+		case TW_ST_SLA_ACK:
+		case TW_ST_ARB_LOST_SLA_ACK:
+		case TW_ST_DATA_ACK:
+			/* the master reads */
+			twiSlaveTransmit();
+			break;
+		case TW_ST_DATA_NACK:
+		case TW_ST_LAST_DATA:
+			/* the read is over, the next one starts at 0 again */
+			window_offset = 0;
+#if USE_TWI_WATCHDOG
+			busy = false;
+#endif
+			break;
+		case TW_SR_STOP:
+#if USE_TWI_WATCHDOG
+			busy = false;
+#endif
+			break;
+		case TW_BUS_ERROR:
+			/* release the bus */
+			control = TWI_ACK | 1<<TWSTO;
+#if USE_TWI_WATCHDOG
+			busy = false;
+#endif
+			break;
+		default:
+			break;
+	}
+	TWCR = control;
+	PROFILE_LEAVE(PROFILE_USI_OVERFLOW, start);
+}
+#endif
@@ -0,0 +1,13 @@
+/* TWI slave on the hardware TWI peripheral, same interface as usiTwiSlave.h */
+#include <stdint.h>
+#include <stddef.h>
+
+void twiSlaveInit(uint8_t address);
+void twiSlaveSetTrap(void (*trap)(uint8_t offset), uint8_t first);
+void twiSlaveSetReceiver(void (*receiver)(uint8_t offset, uint8_t data));
+void twiSlaveSetFlowControl(uint8_t (*ready)(uint8_t offset));
+void twiSlaveSetStream(uint8_t offset);
+void twiSlaveSetTransmitWindow(void *start, size_t size);
+uint8_t twiSlaveWatchdog(void);
+void twiSlaveSetAddress(uint8_t address);
+void twiSlaveSetGeneralCall(void (*command)(uint8_t data));
@@ -39,10 +39,21 @@ Change Activity:
 
 ********************************************************************************/
 
+#include "config.h"
+#include "hal.h"
+#if HAL_TWI_USI
 #include <stdlib.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "usiTwiSlave.h"
+#include "profile.h"
+
+#if __AVR__
+#include <util/atomic.h>
+#define ATOMIC(t) ATOMIC_BLOCK(t)
+#else
+#define ATOMIC(t)
+#endif
 
 
 
@@ -179,6 +190,20 @@ Change Activity:
        ( 0x0E << USICNT0 ); \
 }
 
+#define SET_USI_TO_SEND_NACK( ) \
+{ \
+  /* release SDA, it stays high during the acknowledge bit */ \
+  DDR_USI &= ~( 1 << PORT_USI_SDA ); \
+  /* clear all interrupt flags, except Start Cond */ \
+  USISR = \
+       ( 0 << USI_START_COND_INT ) | \
+       ( 1 << USIOIF ) | \
+       ( 1 << USIPF ) | \
+       ( 1 << USIDC ) | \
+       /* set USI counter to shift 1 bit */ \
+       ( 0x0E << USICNT0 ); \
+}
+
 #define SET_USI_TO_TWI_START_CONDITION_MODE( ) \
 { \
   USICR = \
@@ -236,7 +261,8 @@ typedef enum
   USI_SLAVE_REQUEST_REPLY_FROM_SEND_DATA = 0x02,
   USI_SLAVE_CHECK_REPLY_FROM_SEND_DATA   = 0x03,
   USI_SLAVE_REQUEST_DATA                 = 0x04,
-  USI_SLAVE_GET_DATA_AND_SEND_ACK        = 0x05
+  USI_SLAVE_GET_DATA_AND_SEND_ACK        = 0x05,
+  USI_SLAVE_NACK_SENT                    = 0x06
 } overflowState_t;
 
 
@@ -255,7 +281,25 @@ static volatile void    *tx_window_end;
 static volatile void    *tx_window_cur;
 static volatile size_t  tx_window_offset;
 
-static void (*window_trap)(void) = NULL;
+static void (*window_trap)(uint8_t) = NULL;
+static uint8_t window_trap_offset;
+static void (*window_receiver)(uint8_t, uint8_t) = NULL;
+static uint8_t (*window_ready)(uint8_t) = NULL;
+static void (*general_call)(uint8_t) = NULL;
+static volatile bool    rx_offset_pending;
+static volatile bool    rx_general_call;
+static uint8_t          stream_offset = 0xFF;
+
+#if USE_TWI_WATCHDOG
+// give up waiting for the start condition to complete after about 1 ms
+// (the loop takes about 8 cycles)
+#define USI_START_SPIN ( F_CPU / 8000 )
+
+// incremented by every interrupt, the watchdog looks for a standstill
+static volatile uint8_t activity;
+static uint8_t          activity_seen;
+static volatile uint8_t recoveries;
+#endif
 
 /********************************************************************************
 
@@ -288,13 +332,107 @@ flushTwiBuffers(
 ********************************************************************************/
 
 
-// set trap function
+// set trap function, called with the window offset of every byte at or
+// beyond the given offset right before it is transmitted
+
 void
 usiTwiSlaveSetTrap(
-  void (*trap)(void)
+  void (*trap)(uint8_t),
+  uint8_t offset
 )
 {
   window_trap = trap;
+  window_trap_offset = offset;
+}
+
+// set receive function, called with the window offset and the value of every
+// byte the master writes after the address offset
+
+void
+usiTwiSlaveSetReceiver(
+  void (*receiver)(uint8_t, uint8_t)
+)
+{
+  window_receiver = receiver;
+}
+
+// change the own address, compared with the next address byte
+
+void
+usiTwiSlaveSetAddress(
+  uint8_t ownAddress
+)
+{
+  slaveAddress = ownAddress;
+}
+
+// set general call function, called with every byte written to address 0;
+// general calls are not acknowledged without it
+
+void
+usiTwiSlaveSetGeneralCall(
+  void (*command)(uint8_t)
+)
+{
+  general_call = command;
+}
+
+// set flow control function, called with the window offset of every byte
+// the master writes after the address offset; the byte is not acknowledged
+// (and not handed to the receiver) if it returns 0
+
+void
+usiTwiSlaveSetFlowControl(
+  uint8_t (*ready)(uint8_t)
+)
+{
+  window_ready = ready;
+}
+
+#if USE_TWI_WATCHDOG
+// call every TWI_STUCK_TIMEOUT ms; a transfer that saw no interrupt since
+// the last call, no stop condition and has SDA or SCL low is abandoned and
+// the lines are released; returns the number of recoveries since the last
+// call
+
+uint8_t
+usiTwiSlaveWatchdog(
+  void
+)
+{
+  uint8_t n;
+  ATOMIC( ATOMIC_FORCEON )
+  {
+    if ( activity == activity_seen &&
+         // in a transfer
+         ( USICR & ( 1 << USIOIE ) ) && !( USISR & ( 1 << USIPF ) ) &&
+         // and a line is held low
+         ( PIN_USI & ( ( 1 << PIN_USI_SDA ) | ( 1 << PIN_USI_SCL ) ) ) !=
+         ( ( 1 << PIN_USI_SDA ) | ( 1 << PIN_USI_SCL ) ) )
+    {
+      // release SDA and SCL, wait for the next start condition
+      DDR_USI &= ~( 1 << PORT_USI_SDA );
+      overflowState = USI_SLAVE_CHECK_ADDRESS;
+      SET_USI_TO_TWI_START_CONDITION_MODE( );
+      recoveries++;
+    }
+    activity_seen = activity;
+    n = recoveries;
+    recoveries = 0;
+  }
+  return n;
+}
+#endif
+
+// set stream register; reading or writing this offset does not advance the
+// window, so a burst transfers all bytes through the same register
+
+void
+usiTwiSlaveSetStream(
+  uint8_t offset
+)
+{
+  stream_offset = offset;
 }
 
 // initialise USI for TWI slave mode
@@ -365,6 +503,13 @@ void usiTwiSetTransmitWindow(
 ISR( USI_START_VECTOR )
 {
 
+  PROFILE_ENTER( start );
+
+#if USE_TWI_WATCHDOG
+  uint16_t spin = USI_START_SPIN;
+  activity++;
+#endif
+
   // set default starting conditions for new TWI package
   overflowState = USI_SLAVE_CHECK_ADDRESS;
 
@@ -381,10 +526,25 @@ ISR( USI_START_VECTOR )
        ( PIN_USI & ( 1 << PIN_USI_SCL ) ) &&
        // and SDA is low
        !( ( PIN_USI & ( 1 << PIN_USI_SDA ) ) )
+#if USE_TWI_WATCHDOG
+       // unless SDA is stuck low
+       && --spin
+#endif
   );
 
+#if USE_TWI_WATCHDOG
+  if ( !spin )
+  {
+    // treat it like a Stop Condition below
+    recoveries++;
+  }
+#endif
 
-  if ( !( PIN_USI & ( 1 << PIN_USI_SDA ) ) )
+  if ( !( PIN_USI & ( 1 << PIN_USI_SDA ) )
+#if USE_TWI_WATCHDOG
+       && spin
+#endif
+     )
   {
 
     // a Stop Condition did not occur
@@ -430,6 +590,8 @@ ISR( USI_START_VECTOR )
        // set USI to sample 8 bits (count 16 external SCL pin toggles)
        ( 0x0 << USICNT0);
 
+  PROFILE_LEAVE( PROFILE_USI_START, start );
+
 } // end ISR( USI_START_VECTOR )
 
 
@@ -447,13 +609,19 @@ Only disabled when waiting for a new Start Condition.
 ISR( USI_OVERFLOW_VECTOR )
 {
 
+  PROFILE_ENTER( start );
+
+#if USE_TWI_WATCHDOG
+  activity++;
+#endif
+
   switch ( overflowState )
   {
 
     // Address mode: check address and send ACK (and next USI_SLAVE_SEND_DATA) if OK,
     // else reset USI
     case USI_SLAVE_CHECK_ADDRESS:
-      if ( ( USIDR == 0 ) || ( ( USIDR >> 1 ) == slaveAddress) )
+      if ( ( USIDR == 0 && general_call ) || ( ( USIDR >> 1 ) == slaveAddress) )
       {
           if ( USIDR & 0x01 )
         {
@@ -465,6 +633,8 @@ ISR( USI_OVERFLOW_VECTOR )
         else
         {
           overflowState = USI_SLAVE_REQUEST_DATA;
+          rx_offset_pending = true;
+          rx_general_call = ( USIDR == 0 );
         } // end if
         SET_USI_TO_SEND_ACK( );
       }
@@ -481,7 +651,7 @@ ISR( USI_OVERFLOW_VECTOR )
       {
         // if NACK, the master does not want more data
         SET_USI_TO_TWI_START_CONDITION_MODE( );
-        return;
+        break;
       }
       // from here we just drop straight into USI_SLAVE_SEND_DATA if the
       // master sent an ACK
@@ -493,15 +663,16 @@ ISR( USI_OVERFLOW_VECTOR )
       // FIXME Does not work - why oh why?!
       if ( tx_window_cur >= tx_window_start && tx_window_cur < tx_window_end )
       {
+        uint8_t offset = tx_window_cur - tx_window_start;
+        if ( window_trap && offset >= window_trap_offset ) window_trap( offset );
         USIDR = *(uint8_t*)(tx_window_cur);
-	tx_window_cur++;
-	if (tx_window_cur == tx_window_end && window_trap) window_trap();
+        if ( offset != stream_offset ) tx_window_cur++;
       }
       else
       {
         // the buffer is empty
         SET_USI_TO_TWI_START_CONDITION_MODE( );
-        return;
+        break;
       } // end if
       overflowState = USI_SLAVE_REQUEST_REPLY_FROM_SEND_DATA;
       SET_USI_TO_SEND_DATA( );
@@ -524,12 +695,47 @@ ISR( USI_OVERFLOW_VECTOR )
     // copy data from USIDR and send ACK
     // next USI_SLAVE_REQUEST_DATA
     case USI_SLAVE_GET_DATA_AND_SEND_ACK:
-      /* we assume that the data is an address offset */
-      tx_window_offset = USIDR;
+      if ( rx_general_call )
+      {
+        // general calls carry commands, they never touch the window;
+        // the bytes following the command are its parameters
+        if ( rx_offset_pending )
+        {
+          general_call( USIDR );
+          rx_offset_pending = false;
+        }
+      }
+      else if ( rx_offset_pending )
+      {
+        /* the first byte is the address offset */
+        tx_window_offset = USIDR;
+        rx_offset_pending = false;
+      }
+      else if ( window_ready && !window_ready( tx_window_offset ) )
+      {
+        // the receiver cannot take the byte, the master has to stop
+        overflowState = USI_SLAVE_NACK_SENT;
+        SET_USI_TO_SEND_NACK( );
+        break;
+      }
+      else
+      {
+        /* subsequent bytes are written to the window */
+        if ( window_receiver ) window_receiver( tx_window_offset, USIDR );
+        if ( tx_window_offset != stream_offset ) tx_window_offset++;
+      }
       overflowState = USI_SLAVE_REQUEST_DATA;
       SET_USI_TO_SEND_ACK( );
       break;
 
+    // the NACK has been clocked out, wait for the stop condition
+    case USI_SLAVE_NACK_SENT:
+      SET_USI_TO_TWI_START_CONDITION_MODE( );
+      break;
+
   } // end switch
 
+  PROFILE_LEAVE( PROFILE_USI_OVERFLOW, start );
+
 } // end ISR( USI_OVERFLOW_VECTOR )
+#endif
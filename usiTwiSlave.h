@@ -53,7 +53,13 @@ Change Activity:
 ********************************************************************************/
 
 void    usiTwiSlaveInit( uint8_t );
-void    usiTwiSlaveSetTrap( void (*trap)(void));
+void    usiTwiSlaveSetTrap( void (*trap)(uint8_t), uint8_t );
+void    usiTwiSlaveSetReceiver( void (*receiver)(uint8_t, uint8_t) );
+void    usiTwiSlaveSetFlowControl( uint8_t (*ready)(uint8_t) );
+void    usiTwiSlaveSetStream( uint8_t );
 void    usiTwiSetTransmitWindow( void*, size_t );
+uint8_t usiTwiSlaveWatchdog( void );
+void    usiTwiSlaveSetAddress( uint8_t );
+void    usiTwiSlaveSetGeneralCall( void (*command)(uint8_t) );
 
 #endif  // ifndef _USI_TWI_SLAVE_H_